@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Host micro-benchmark of the fixed-point JSON serializer
+ * (json_fixed.c) against the sprintf("%f") path it replaces. See Readme.md
+ * in this folder for how to build and run it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "json_fixed.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+#define BENCH_ITERATIONS    200000
+#define BENCH_SAMPLES       64
+
+#define BENCH_DEV_STR       "C0:11:22:33:44:55"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+typedef struct{
+    uint32_t id;
+    float co2;
+    float humidity;
+    float temperature;
+}benchSample_t;
+
+typedef int (*benchEncode_t)(char *pBuf, size_t size, const benchSample_t *pSample);
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static benchSample_t gSamples[BENCH_SAMPLES];
+
+/** Keeps the compiler from optimizing the encoding away */
+static volatile size_t gSink;
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** The path being replaced: clear the message buffer, then sprintf with %f */
+static int encodeSprintf(char *pBuf, size_t size, const benchSample_t *pSample)
+{
+    memset(pBuf, 0, size);
+
+    return snprintf(pBuf, size,
+                    "{\"dev\":\"%s\",\"id\":%u,\"c02level\":%f,\"humidity\":%f,\"temperature\":%f}",
+                    BENCH_DEV_STR, (unsigned)pSample->id,
+                    pSample->co2, pSample->humidity, pSample->temperature);
+}
+
+
+static int encodeFixed(char *pBuf, size_t size, const benchSample_t *pSample)
+{
+    static const jsonFixedDecimals_t decimals = { .co2 = 0, .humidity = 2, .temperature = 2 };
+
+    return jsonFixedWriteSample(pBuf, size, BENCH_DEV_STR, pSample->id,
+                                pSample->co2, pSample->humidity, pSample->temperature, 0,
+                                &decimals);
+}
+
+
+/** Timestamp in CPU cycles where available (TSC), else in nanoseconds */
+static uint64_t benchNow(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+static void benchRun(const char *pName, benchEncode_t encode)
+{
+    char buf[200];
+    uint64_t start;
+    uint64_t end;
+    size_t bytes = 0;
+    int len = 0;
+
+    // warm up the caches
+    for( int i = 0; i < BENCH_SAMPLES; i++ ){
+        encode(buf, sizeof(buf), &gSamples[i]);
+    }
+
+    start = benchNow();
+    for( int i = 0; i < BENCH_ITERATIONS; i++ ){
+        len = encode(buf, sizeof(buf), &gSamples[i % BENCH_SAMPLES]);
+        bytes += (size_t)len;
+    }
+    end = benchNow();
+    gSink = bytes;
+
+    printf("%-8s %8.1f %s/message, %6.1f bytes/message, e.g. %.*s\n",
+           pName,
+           (double)(end - start) / BENCH_ITERATIONS,
+#if defined(__x86_64__) || defined(__i386__)
+           "cycles",
+#else
+           "ns",
+#endif
+           (double)bytes / BENCH_ITERATIONS,
+           len, buf);
+}
+
+
+/** Checks that both paths give the same values (within the rounding) */
+static int benchCheck(void)
+{
+    char fixedBuf[200];
+    char refBuf[200];
+    int errors = 0;
+
+    for( int i = 0; i < BENCH_SAMPLES; i++ ){
+        unsigned id;
+        float fixed[3];
+        float ref[3];
+        int len = encodeFixed(fixedBuf, sizeof(fixedBuf) - 1, &gSamples[i]);
+
+        fixedBuf[len] = '\0';
+        encodeSprintf(refBuf, sizeof(refBuf), &gSamples[i]);
+
+        if( ( sscanf(fixedBuf, "{\"dev\":\"" BENCH_DEV_STR "\",\"id\":%u,\"c02level\":%f,\"humidity\":%f,\"temperature\":%f}",
+                     &id, &fixed[0], &fixed[1], &fixed[2]) != 4 ) ||
+            ( sscanf(refBuf, "{\"dev\":\"" BENCH_DEV_STR "\",\"id\":%u,\"c02level\":%f,\"humidity\":%f,\"temperature\":%f}",
+                     &id, &ref[0], &ref[1], &ref[2]) != 4 ) ||
+            ( id != gSamples[i].id ) ||
+            ( abs((int)( fixed[0] - ref[0] )) > 0 ) ||
+            ( ( fixed[1] - ref[1] ) > 0.0051f ) || ( ( ref[1] - fixed[1] ) > 0.0051f ) ||
+            ( ( fixed[2] - ref[2] ) > 0.0051f ) || ( ( ref[2] - fixed[2] ) > 0.0051f ) ){
+            printf("Mismatch:\n  %s\n  %s\n", fixedBuf, refBuf);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+/* ----------------------------------------------------------------
+ * MAIN
+ * -------------------------------------------------------------- */
+
+int main(void)
+{
+    srand(1);
+
+    // realistic SCD41 values, including negative temperatures
+    for( int i = 0; i < BENCH_SAMPLES; i++ ){
+        gSamples[i].id = 1000u + (uint32_t)i * 37u;
+        gSamples[i].co2 = 400.0f + (float)( rand() % 4600 );
+        gSamples[i].humidity = (float)( rand() % 10000 ) / 100.0f;
+        gSamples[i].temperature = (float)( rand() % 6000 - 1000 ) / 100.0f;
+    }
+
+    if( benchCheck() != 0 ){
+        return 1;
+    }
+
+    benchRun("sprintf", encodeSprintf);
+    benchRun("fixed", encodeFixed);
+
+    return 0;
+}
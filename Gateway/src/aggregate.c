@@ -0,0 +1,207 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** @file
+ * @brief Contains the implementation of the API described in aggregate.h
+ */
+
+#include "aggregate.h"
+
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <string.h>
+
+#include "device_table.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Running statistics of a value */
+typedef struct{
+    float min;
+    float max;
+    float sum;
+    float last;
+}aggregateAcc_t;
+
+/** Running statistics of a broadcaster over the current window */
+typedef struct{
+    uint32_t count;
+    uint32_t lastMsgId;
+    uint64_t lastTimeMs;
+    aggregateAcc_t co2;
+    aggregateAcc_t humidity;
+    aggregateAcc_t temperature;
+}deviceAggregate_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** Length (msec) of the windows */
+static const uint32_t gWindowMs[] = {
+    CONFIG_AQM_AGGREGATE_WINDOW_S * 1000U,
+#if CONFIG_AQM_AGGREGATE_WINDOW2_S > 0
+    CONFIG_AQM_AGGREGATE_WINDOW2_S * 1000U,
+#endif
+};
+
+#define AGGREGATE_WINDOWS   ((int)ARRAY_SIZE(gWindowMs))
+
+static deviceAggregate_t gAggregate[AGGREGATE_WINDOWS][CONFIG_AQM_MAX_DEVICES];
+
+/** Uptime (msec) when the current window ends */
+static uint32_t gWindowEndMs[AGGREGATE_WINDOWS];
+
+/** Next device whose rollup is taken, once the window has ended */
+static uint32_t gNextDevice[AGGREGATE_WINDOWS];
+
+static atomic_t gSamples = ATOMIC_INIT(0);
+static atomic_t gWindows = ATOMIC_INIT(0);
+static atomic_t gRollups = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+static void aggregateAccAdd(aggregateAcc_t *pAcc, float value, bool first)
+{
+    if( first || ( value < pAcc->min ) ){
+        pAcc->min = value;
+    }
+    if( first || ( value > pAcc->max ) ){
+        pAcc->max = value;
+    }
+    pAcc->sum += value;
+    pAcc->last = value;
+}
+
+
+static void aggregateAccGet(const aggregateAcc_t *pAcc, uint32_t count, aggregateValue_t *pValue)
+{
+    pValue->min = pAcc->min;
+    pValue->max = pAcc->max;
+    pValue->mean = pAcc->sum / (float)count;
+    pValue->last = pAcc->last;
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void aggregateStart(uint32_t nowMs)
+{
+    for( int w = 0; w < AGGREGATE_WINDOWS; w++ ){
+        gWindowEndMs[w] = nowMs + gWindowMs[w];
+        gNextDevice[w] = 0;
+    }
+}
+
+
+void aggregateAdd(const aqmSample_t *pSample)
+{
+    const aqmMeasurement_t *pMeas = &pSample->meas;
+
+    for( int w = 0; w < AGGREGATE_WINDOWS; w++ ){
+        deviceAggregate_t *pAgg = &gAggregate[w][pSample->deviceIndex];
+        bool first = ( pAgg->count == 0 );
+
+        aggregateAccAdd(&pAgg->co2, pMeas->co2, first);
+        aggregateAccAdd(&pAgg->humidity, pMeas->humidity, first);
+        aggregateAccAdd(&pAgg->temperature, pMeas->temperature, first);
+        pAgg->lastMsgId = pMeas->message_id;
+        pAgg->lastTimeMs = pSample->timeMs;
+        pAgg->count++;
+    }
+
+    atomic_inc(&gSamples);
+}
+
+
+int32_t aggregateTimeLeftMs(uint32_t nowMs)
+{
+    int32_t left = INT32_MAX;
+
+    for( int w = 0; w < AGGREGATE_WINDOWS; w++ ){
+        left = MIN(left, (int32_t)( gWindowEndMs[w] - nowMs ));
+    }
+
+    return ( left > 0 ) ? left : 0;
+}
+
+
+bool aggregateNext(uint32_t nowMs, aggregateRollup_t *pRollup)
+{
+    uint32_t count = deviceTableCount();
+
+    for( int w = 0; w < AGGREGATE_WINDOWS; w++ ){
+        if( (int32_t)( nowMs - gWindowEndMs[w] ) < 0 ){
+            continue;
+        }
+
+        // one rollup per broadcaster with samples in the window
+        while( gNextDevice[w] < count ){
+            uint32_t i = gNextDevice[w]++;
+            deviceAggregate_t *pAgg = &gAggregate[w][i];
+
+            if( pAgg->count == 0 ){
+                continue;
+            }
+
+            pRollup->deviceIndex = (uint16_t)i;
+            pRollup->windowS = gWindowMs[w] / 1000;
+            pRollup->count = pAgg->count;
+            pRollup->lastMsgId = pAgg->lastMsgId;
+            pRollup->lastTimeMs = pAgg->lastTimeMs;
+            aggregateAccGet(&pAgg->co2, pAgg->count, &pRollup->co2);
+            aggregateAccGet(&pAgg->humidity, pAgg->count, &pRollup->humidity);
+            aggregateAccGet(&pAgg->temperature, pAgg->count, &pRollup->temperature);
+
+            memset(pAgg, 0, sizeof(*pAgg));
+            atomic_inc(&gRollups);
+
+            return true;
+        }
+
+        // all rollups taken, the next window starts (windows missed while
+        // the thread was blocked are skipped)
+        gNextDevice[w] = 0;
+        do{
+            gWindowEndMs[w] += gWindowMs[w];
+        }while( (int32_t)( nowMs - gWindowEndMs[w] ) >= 0 );
+        atomic_inc(&gWindows);
+    }
+
+    return false;
+}
+
+
+void aggregateGetStats(aggregateStats_t *pStats)
+{
+    pStats->samples = (uint32_t)atomic_get(&gSamples);
+    pStats->windows = (uint32_t)atomic_get(&gWindows);
+    pStats->rollups = (uint32_t)atomic_get(&gRollups);
+}
+
+#endif // CONFIG_AQM_UPLINK_AGGREGATE
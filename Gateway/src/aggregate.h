@@ -0,0 +1,113 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AGGREGATE_H__
+#define  AGGREGATE_H__
+
+/** @file
+ * @brief The aggregate keeps streaming statistics (min, max, mean, last and
+ * count) of the samples of every broadcaster over fixed windows of time
+ * (CONFIG_AQM_AGGREGATE_WINDOW_S and optionally
+ * CONFIG_AQM_AGGREGATE_WINDOW2_S), so that only one rollup per broadcaster
+ * and window is published instead of every sample
+ * (CONFIG_AQM_UPLINK_AGGREGATE).
+ *
+ * Adding a sample is O(1): only the running min, max, sum and last value of
+ * each window are updated. Per-device state is kept in arrays indexed by the
+ * device table index.
+ *
+ * Only used by the uplink thread, not thread safe (except the statistics).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of a value over a window, in the order they are published */
+typedef struct{
+    float min;
+    float max;
+    float mean;
+    float last;
+}aggregateValue_t;
+
+/** Rollup of the samples of a broadcaster over a window */
+typedef struct{
+    uint16_t deviceIndex;           /**< Index of the broadcaster in the device table */
+    uint32_t windowS;               /**< Length of the window (seconds) */
+    uint32_t count;                 /**< Number of samples in the window */
+    uint32_t lastMsgId;             /**< Message id of the last sample */
+    uint64_t lastTimeMs;            /**< Epoch time (msec) of the last sample, zero if not known */
+    aggregateValue_t co2;           /**< CO2 level statistics */
+    aggregateValue_t humidity;      /**< Relative humidity statistics */
+    aggregateValue_t temperature;   /**< Temperature statistics */
+}aggregateRollup_t;
+
+/** Statistics of the aggregate */
+typedef struct{
+    uint32_t samples;       /**< Samples added */
+    uint32_t windows;       /**< Windows closed (all windows lengths) */
+    uint32_t rollups;       /**< Rollups produced */
+}aggregateStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the first window(s).
+ *
+ * @param nowMs  Current uptime (msec).
+ */
+void aggregateStart(uint32_t nowMs);
+
+/** Adds a sample to the current window(s) of its broadcaster.
+ *
+ * @param pSample  The sample.
+ */
+void aggregateAdd(const aqmSample_t *pSample);
+
+/** Gets the time left until the next window ends.
+ *
+ * @param nowMs  Current uptime (msec).
+ * @return       msec until the end of the window, zero if already ended.
+ */
+int32_t aggregateTimeLeftMs(uint32_t nowMs);
+
+/** Takes the next rollup of the windows which have ended, resetting the
+ *  statistics of its broadcaster. Should be called until it returns false
+ *  after every window end, the next window starts then.
+ *
+ * @param nowMs     Current uptime (msec).
+ * @param pRollup   Where the rollup is copied.
+ * @return          true on success, false if there are no more rollups.
+ */
+bool aggregateNext(uint32_t nowMs, aggregateRollup_t *pRollup);
+
+/** Gets a snapshot of the aggregate statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void aggregateGetStats(aggregateStats_t *pStats);
+
+
+#endif // AGGREGATE_H__
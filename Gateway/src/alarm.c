@@ -0,0 +1,110 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** @file
+ * @brief Contains the implementation of the API described in alarm.h
+ */
+
+#include "alarm.h"
+
+#if defined(CONFIG_AQM_ALARM)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** Bit n set: device n is in the alarm state */
+static ATOMIC_DEFINE(gActive, CONFIG_AQM_MAX_DEVICES);
+
+static atomic_t gRaised = ATOMIC_INIT(0);
+static atomic_t gCleared = ATOMIC_INIT(0);
+static atomic_t gPublished = ATOMIC_INIT(0);
+static atomic_t gFailed = ATOMIC_INIT(0);
+static atomic_t gLatencyMsTotal = ATOMIC_INIT(0);
+static atomic_t gLatencyMsMax = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+bool alarmCheck(const aqmSample_t *pSample)
+{
+    int index = pSample->deviceIndex;
+    float co2 = pSample->meas.co2;
+
+    if( !atomic_test_bit(gActive, index) ){
+        if( co2 < CONFIG_AQM_ALARM_CO2_PPM ){
+            return false;
+        }
+        atomic_set_bit(gActive, index);
+        atomic_inc(&gRaised);
+        printk("CO2 alarm raised by device %d (%d ppm)\r\n", index, (int)co2);
+    }
+    else if( co2 < CONFIG_AQM_ALARM_CO2_CLEAR_PPM ){
+        // this last sample shows the alarm is over
+        atomic_clear_bit(gActive, index);
+        atomic_inc(&gCleared);
+        printk("CO2 alarm cleared by device %d (%d ppm)\r\n", index, (int)co2);
+    }
+
+    return true;
+}
+
+
+void alarmPublished(const aqmSample_t *pSample, bool ok, uint32_t nowMs)
+{
+    uint32_t latencyMs = nowMs - pSample->rxTimeMs;
+
+    if( !ok ){
+        atomic_inc(&gFailed);
+        return;
+    }
+
+    atomic_inc(&gPublished);
+    atomic_add(&gLatencyMsTotal, (atomic_val_t)latencyMs);
+    if( latencyMs > (uint32_t)atomic_get(&gLatencyMsMax) ){
+        atomic_set(&gLatencyMsMax, (atomic_val_t)latencyMs);
+    }
+}
+
+
+void alarmGetStats(alarmStats_t *pStats)
+{
+    uint32_t active = 0;
+
+    for( int i = 0; i < CONFIG_AQM_MAX_DEVICES; i++ ){
+        if( atomic_test_bit(gActive, i) ){
+            active++;
+        }
+    }
+
+    pStats->raised = (uint32_t)atomic_get(&gRaised);
+    pStats->cleared = (uint32_t)atomic_get(&gCleared);
+    pStats->active = active;
+    pStats->published = (uint32_t)atomic_get(&gPublished);
+    pStats->failed = (uint32_t)atomic_get(&gFailed);
+    pStats->latencyMsTotal = (uint32_t)atomic_get(&gLatencyMsTotal);
+    pStats->latencyMsMax = (uint32_t)atomic_get(&gLatencyMsMax);
+}
+
+#endif // CONFIG_AQM_ALARM
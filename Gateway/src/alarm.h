@@ -0,0 +1,81 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALARM_H__
+#define  ALARM_H__
+
+/** @file
+ * @brief The alarm picks the samples which should not wait behind the batch
+ * timer or the aggregation window (CONFIG_AQM_ALARM): the samples of a
+ * broadcaster whose CO2 level has reached CONFIG_AQM_ALARM_CO2_PPM, until it
+ * drops below CONFIG_AQM_ALARM_CO2_CLEAR_PPM (hysteresis), the sample which
+ * clears the alarm included. The uplink publishes them on their own, right
+ * away, on the alarm topic.
+ *
+ * Per-device state is kept in arrays indexed by the device table index.
+ * Only used by the uplink thread, the statistics can be read by any thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the alarms */
+typedef struct{
+    uint32_t raised;        /**< Times a broadcaster entered the alarm state */
+    uint32_t cleared;       /**< Times a broadcaster left the alarm state */
+    uint32_t active;        /**< Broadcasters in the alarm state now */
+    uint32_t published;     /**< Alarm samples published */
+    uint32_t failed;        /**< Alarm samples whose publish failed */
+    uint32_t latencyMsTotal;/**< Total reception to publish time (msec) of the published ones */
+    uint32_t latencyMsMax;  /**< Longest reception to publish time (msec) */
+}alarmStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Checks if a sample belongs to the alarm class, updating the alarm state
+ *  of its broadcaster.
+ *
+ * @param pSample  The sample.
+ * @return         true if the sample should be published right away.
+ */
+bool alarmCheck(const aqmSample_t *pSample);
+
+/** Records the outcome of the publish of an alarm sample.
+ *
+ * @param pSample  The sample.
+ * @param ok       true if it was published.
+ * @param nowMs    Uptime (msec) when the publish returned.
+ */
+void alarmPublished(const aqmSample_t *pSample, bool ok, uint32_t nowMs);
+
+/** Gets a snapshot of the alarm statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void alarmGetStats(alarmStats_t *pStats);
+
+
+#endif // ALARM_H__
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AQM_SAMPLE_H__
+#define  AQM_SAMPLE_H__
+
+/** @file
+ * @brief This file defines the measurement data as broadcasted by the
+ * sensor broadcaster and the sample structure which is passed from the
+ * Bluetooth scanner to the uplink (MQTT) side of the Gateway.
+ */
+
+#include <zephyr.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Broadcasters which identify themselves in the primary advertisement put
+ * this header in front of the measurement data (manufacturer specific data):
+ * the company identifier (little endian) followed by the AQM tag.
+ * Note: should be the same as the one used by the broadcaster */
+#define AQM_COMPANY_ID      0xFFFF
+#define AQM_ADV_TAG_0       'A'
+#define AQM_ADV_TAG_1       'Q'
+#define AQM_ADV_HEADER_LEN  4
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Structure holding the measurements of the SCD41 sensor along with
+ * an ascending number which is used as a message id, to separate the
+ * measurement messages, the boot epoch of the broadcaster (a random
+ * number which changes every time the broadcaster reboots)
+ * and the timing of the measurement on the broadcaster.
+ * Note: This struct declaration should be the same as the one used by the
+ * broadcaster. Older broadcasters do not send the boot epoch, see
+ * AQM_MEASUREMENT_LEGACY_LEN, or the timing, see AQM_MEASUREMENT_EPOCH_LEN.
+ */
+typedef struct __packed{
+    float temperature;     /**< Temperature measurement */
+    float humidity;        /**< Humidity measurement */
+    float co2;             /**< CO2 measurement */
+    uint32_t message_id;   /**< Ascending number to identify measurement */
+    uint16_t boot_epoch;   /**< Random number, changes at every broadcaster boot */
+    uint16_t age_ms;       /**< Time (msec) since the fetch completed, when sent (AQM_TIME_UNKNOWN: not sent) */
+    uint16_t fetch_ms;     /**< Duration (msec) of the sensor fetch (AQM_TIME_UNKNOWN: not sent) */
+}aqmMeasurement_t;
+
+/** Length of the measurement data sent by broadcasters without boot epoch */
+#define AQM_MEASUREMENT_LEGACY_LEN  offsetof(aqmMeasurement_t, boot_epoch)
+
+/** Length of the measurement data sent by broadcasters without timing */
+#define AQM_MEASUREMENT_EPOCH_LEN   offsetof(aqmMeasurement_t, age_ms)
+
+/** Timing not sent by the broadcaster, or out of range (65535 msec or more) */
+#define AQM_TIME_UNKNOWN            0xFFFF
+
+
+/** A measurement as received by the Gateway. This is what travels from the
+ * Bluetooth scan callback to the uplink thread.
+ */
+typedef struct{
+    aqmMeasurement_t meas;  /**< The measurement data of the broadcaster */
+    uint32_t rxTimeMs;      /**< Uptime (msec) when the advertisement was received */
+    uint64_t timeMs;        /**< Epoch time (msec) of the measurement, zero if not known */
+    uint16_t deviceIndex;   /**< Index of the broadcaster in the device table */
+    int8_t rssi;            /**< RSSI of the advertisement */
+}aqmSample_t;
+
+
+#endif // AQM_SAMPLE_H__
@@ -0,0 +1,429 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in batch.h
+ */
+
+#include "batch.h"
+
+#include <zephyr.h>
+#include <sys/byteorder.h>
+#include <bluetooth/bluetooth.h>
+#include <string.h>
+#include <errno.h>
+
+#include "json_fixed.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+#if defined(CONFIG_AQM_PAYLOAD_CBOR)
+
+/** CBOR major types (RFC 8949), in the top 3 bits of the initial byte */
+#define CBOR_UINT           0x00
+#define CBOR_BYTES          0x40
+#define CBOR_ARRAY          0x80
+#define CBOR_FLOAT32        0xFA
+#define CBOR_NULL           0xF6
+
+/** Version of the sample schema, the position of every field in a sample.
+ * Version 2 added the time */
+#define BATCH_CBOR_VERSION  2
+
+/** {"v":2,"s":[_ (indefinite length array, closed by the tail) */
+static const uint8_t gSamplesHead[] = { 0xA2, 0x61, 'v', BATCH_CBOR_VERSION,
+                                        0x61, 's', 0x9F };
+/** {"v":2,"r":[_ (indefinite length array of rollups, closed by the tail) */
+static const uint8_t gRollupsHead[] = { 0xA2, 0x61, 'v', BATCH_CBOR_VERSION,
+                                        0x61, 'r', 0x9F };
+/** break, closes the indefinite length array */
+static const uint8_t gBatchTail[] = { 0xFF };
+
+#define BATCH_HEAD_LEN      sizeof(gSamplesHead)
+#define BATCH_TAIL_LEN      sizeof(gBatchTail)
+
+#else
+
+static const char gSamplesHead[] = "{\"samples\":[";
+static const char gRollupsHead[] = "{\"rollups\":[";
+static const char gBatchTail[] = "]}";
+
+// without the string terminators
+#define BATCH_HEAD_LEN      ( sizeof(gSamplesHead) - 1 )
+#define BATCH_TAIL_LEN      ( sizeof(gBatchTail) - 1 )
+
+#endif
+
+BUILD_ASSERT(sizeof(gSamplesHead) == sizeof(gRollupsHead), "The heads should have the same length");
+
+/** The batches hold either samples or rollups */
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+#define BATCH_HEAD          gRollupsHead
+#else
+#define BATCH_HEAD          gSamplesHead
+#endif
+
+/** Maximum length of one sample (or rollup) in the batch */
+#define BATCH_ENTRY_MAX_LEN 320
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** The batch message. The head is always in place */
+static char gBatch[CONFIG_AQM_BATCH_MAX_BYTES];
+static size_t gBatchLen;
+static uint32_t gBatchCount;
+
+/** Uptime (msec) when the first sample was added to the batch. Not the
+ * reception time: samples forwarded after an outage are already old */
+static uint32_t gBatchOldestMs;
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+#if defined(CONFIG_AQM_PAYLOAD_CBOR)
+
+/** Writes the initial byte of a CBOR data item and its argument, in the
+ * shortest form. Returns the number of bytes written */
+static size_t cborPutHead(uint8_t *pBuf, uint8_t majorType, uint32_t value)
+{
+    if( value < 24 ){
+        pBuf[0] = majorType | value;
+        return 1;
+    }
+    if( value <= UINT8_MAX ){
+        pBuf[0] = majorType | 24;
+        pBuf[1] = value;
+        return 2;
+    }
+    if( value <= UINT16_MAX ){
+        pBuf[0] = majorType | 25;
+        sys_put_be16(value, &pBuf[1]);
+        return 3;
+    }
+    pBuf[0] = majorType | 26;
+    sys_put_be32(value, &pBuf[1]);
+    return 5;
+}
+
+
+/** Writes a time (msec since the Unix epoch) as an unsigned integer, or
+ * null if not known. Returns the number of bytes written */
+static size_t cborPutTime(uint8_t *pBuf, uint64_t timeMs)
+{
+    if( timeMs == 0 ){
+        pBuf[0] = CBOR_NULL;
+        return 1;
+    }
+    if( timeMs <= UINT32_MAX ){
+        return cborPutHead(pBuf, CBOR_UINT, (uint32_t)timeMs);
+    }
+    pBuf[0] = CBOR_UINT | 27;
+    sys_put_be64(timeMs, &pBuf[1]);
+    return 9;
+}
+
+
+/** Writes a single precision float. Returns the number of bytes written */
+static size_t cborPutFloat(uint8_t *pBuf, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    pBuf[0] = CBOR_FLOAT32;
+    sys_put_be32(bits, &pBuf[1]);
+
+    return 5;
+}
+
+
+/** Encodes a sample as a CBOR array:
+ *  [device address (6 bytes, most significant first), message id,
+ *   co2, humidity, temperature, time (msec since the Unix epoch) or null]
+ * Returns the length of the encoded sample */
+static int batchEncodeSample(const aqmSample_t *pSample, const bt_addr_t *pAddr,
+                             uint8_t *pBuf, size_t size)
+{
+    const aqmMeasurement_t *pMeas = &pSample->meas;
+    size_t len = 0;
+
+    // at most 1 + 7 + 5 + 3 * 5 + 9 bytes
+    if( size < 37 ){
+        return -EINVAL;
+    }
+
+    len += cborPutHead(&pBuf[len], CBOR_ARRAY, 6);
+    len += cborPutHead(&pBuf[len], CBOR_BYTES, sizeof(pAddr->val));
+    for( int i = sizeof(pAddr->val) - 1; i >= 0; i-- ){
+        pBuf[len++] = pAddr->val[i];
+    }
+    len += cborPutHead(&pBuf[len], CBOR_UINT, pMeas->message_id);
+    len += cborPutFloat(&pBuf[len], pMeas->co2);
+    len += cborPutFloat(&pBuf[len], pMeas->humidity);
+    len += cborPutFloat(&pBuf[len], pMeas->temperature);
+    len += cborPutTime(&pBuf[len], pSample->timeMs);
+
+    return (int)len;
+}
+
+
+/** Writes the statistics of a value as a CBOR array [min, max, mean, last].
+ * Returns the number of bytes written */
+static size_t cborPutValue(uint8_t *pBuf, const aggregateValue_t *pValue)
+{
+    size_t len = 0;
+
+    len += cborPutHead(&pBuf[len], CBOR_ARRAY, 4);
+    len += cborPutFloat(&pBuf[len], pValue->min);
+    len += cborPutFloat(&pBuf[len], pValue->max);
+    len += cborPutFloat(&pBuf[len], pValue->mean);
+    len += cborPutFloat(&pBuf[len], pValue->last);
+
+    return len;
+}
+
+
+/** Encodes a rollup as a CBOR array:
+ *  [device address, window (s), count, last message id,
+ *   [co2 min, max, mean, last], [humidity ...], [temperature ...],
+ *   time of the last sample or null]
+ * Returns the length of the encoded rollup */
+static int batchEncodeRollup(const aggregateRollup_t *pRollup, const bt_addr_t *pAddr,
+                             uint8_t *pBuf, size_t size)
+{
+    size_t len = 0;
+
+    // at most 1 + 7 + 3 * 5 + 3 * 21 + 9 bytes
+    if( size < 95 ){
+        return -EINVAL;
+    }
+
+    len += cborPutHead(&pBuf[len], CBOR_ARRAY, 8);
+    len += cborPutHead(&pBuf[len], CBOR_BYTES, sizeof(pAddr->val));
+    for( int i = sizeof(pAddr->val) - 1; i >= 0; i-- ){
+        pBuf[len++] = pAddr->val[i];
+    }
+    len += cborPutHead(&pBuf[len], CBOR_UINT, pRollup->windowS);
+    len += cborPutHead(&pBuf[len], CBOR_UINT, pRollup->count);
+    len += cborPutHead(&pBuf[len], CBOR_UINT, pRollup->lastMsgId);
+    len += cborPutValue(&pBuf[len], &pRollup->co2);
+    len += cborPutValue(&pBuf[len], &pRollup->humidity);
+    len += cborPutValue(&pBuf[len], &pRollup->temperature);
+    len += cborPutTime(&pBuf[len], pRollup->lastTimeMs);
+
+    return (int)len;
+}
+
+#else
+
+BUILD_ASSERT(sizeof(aggregateValue_t) == JSON_FIXED_ROLLUP_STATS * sizeof(float),
+             "aggregateValue_t should be an array of the rollup statistics");
+
+/** Decimals of the JSON values */
+static const jsonFixedDecimals_t gDecimals = {
+    .co2 = 0,
+    .humidity = CONFIG_AQM_JSON_HUMIDITY_DECIMALS,
+    .temperature = CONFIG_AQM_JSON_TEMPERATURE_DECIMALS
+};
+
+/** Encodes a sample as a JSON object, with fixed-point values. Returns the
+ * length of the encoded sample */
+static int batchEncodeSample(const aqmSample_t *pSample, const bt_addr_t *pAddr,
+                             uint8_t *pBuf, size_t size)
+{
+    const aqmMeasurement_t *pMeas = &pSample->meas;
+    char addrStr[BT_ADDR_STR_LEN];
+    int len;
+
+    bt_addr_to_str(pAddr, addrStr, sizeof(addrStr));
+
+    len = jsonFixedWriteSample((char *)pBuf, size, addrStr, pMeas->message_id,
+                               pMeas->co2, pMeas->humidity, pMeas->temperature,
+                               pSample->timeMs, &gDecimals);
+
+    return ( len < 0 ) ? -EINVAL : len;
+}
+
+
+/** Encodes a rollup as a JSON object, with fixed-point values. Returns the
+ * length of the encoded rollup */
+static int batchEncodeRollup(const aggregateRollup_t *pRollup, const bt_addr_t *pAddr,
+                             uint8_t *pBuf, size_t size)
+{
+    // the statistics in the order of aggregateValue_t
+    const float *pCo2 = &pRollup->co2.min;
+    const float *pHumidity = &pRollup->humidity.min;
+    const float *pTemperature = &pRollup->temperature.min;
+    char addrStr[BT_ADDR_STR_LEN];
+    int len;
+
+    bt_addr_to_str(pAddr, addrStr, sizeof(addrStr));
+
+    len = jsonFixedWriteRollup((char *)pBuf, size, addrStr, pRollup->windowS,
+                               pRollup->count, pRollup->lastMsgId,
+                               pCo2, pHumidity, pTemperature, pRollup->lastTimeMs,
+                               &gDecimals);
+
+    return ( len < 0 ) ? -EINVAL : len;
+}
+
+#endif
+
+
+/** Writes the separator needed before the next entry, returns its length */
+static size_t batchSeparator(uint8_t *pBuf)
+{
+#if !defined(CONFIG_AQM_PAYLOAD_CBOR)
+    // JSON array elements are separated by commas
+    if( gBatchCount > 0 ){
+        pBuf[0] = ',';
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+
+/** Appends an encoded entry (with its separator) to the batch */
+static int batchAppend(const uint8_t *pEntry, size_t len)
+{
+    if( gBatchCount == 0 ){
+        memcpy(gBatch, BATCH_HEAD, BATCH_HEAD_LEN);
+        gBatchLen = BATCH_HEAD_LEN;
+    }
+
+    // keep room for the tail, added by batchFinish()
+    if( gBatchLen + len + BATCH_TAIL_LEN > sizeof(gBatch) ){
+        return ( gBatchCount > 0 ) ? -ENOSPC : -EINVAL;
+    }
+
+    memcpy(&gBatch[gBatchLen], pEntry, len);
+    gBatchLen += len;
+
+    if( gBatchCount == 0 ){
+        gBatchOldestMs = k_uptime_get_32();
+    }
+    gBatchCount++;
+
+    return 0;
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+int batchAdd(const aqmSample_t *pSample, const bt_addr_le_t *pAddr)
+{
+    uint8_t entry[BATCH_ENTRY_MAX_LEN];
+    size_t sepLen = batchSeparator(entry);
+    int len;
+
+    len = batchEncodeSample(pSample, &pAddr->a, &entry[sepLen], sizeof(entry) - sepLen);
+    if( len < 0 ){
+        return len;
+    }
+
+    return batchAppend(entry, len + sepLen);
+}
+
+
+int batchAddRollup(const aggregateRollup_t *pRollup, const bt_addr_le_t *pAddr)
+{
+    uint8_t entry[BATCH_ENTRY_MAX_LEN];
+    size_t sepLen = batchSeparator(entry);
+    int len;
+
+    len = batchEncodeRollup(pRollup, &pAddr->a, &entry[sepLen], sizeof(entry) - sepLen);
+    if( len < 0 ){
+        return len;
+    }
+
+    return batchAppend(entry, len + sepLen);
+}
+
+
+int batchEncodeSingle(const aqmSample_t *pSample, const bt_addr_le_t *pAddr,
+                      char *pBuf, size_t size)
+{
+    int len;
+
+    if( size < BATCH_HEAD_LEN + BATCH_TAIL_LEN ){
+        return -EINVAL;
+    }
+
+    // always a samples message, also when the batches hold rollups
+    memcpy(pBuf, gSamplesHead, BATCH_HEAD_LEN);
+    len = batchEncodeSample(pSample, &pAddr->a, (uint8_t *)&pBuf[BATCH_HEAD_LEN],
+                            size - BATCH_HEAD_LEN - BATCH_TAIL_LEN);
+    if( len < 0 ){
+        return len;
+    }
+    len += BATCH_HEAD_LEN;
+    memcpy(&pBuf[len], gBatchTail, BATCH_TAIL_LEN);
+
+    return len + BATCH_TAIL_LEN;
+}
+
+
+uint32_t batchCount(void)
+{
+    return gBatchCount;
+}
+
+
+bool batchIsFull(void)
+{
+    return gBatchCount >= CONFIG_AQM_BATCH_MAX_SAMPLES;
+}
+
+
+int32_t batchTimeLeftMs(uint32_t nowMs)
+{
+    int32_t left;
+
+    if( gBatchCount == 0 ){
+        return -1;
+    }
+
+    left = (int32_t)(gBatchOldestMs + CONFIG_AQM_BATCH_MAX_AGE_MS - nowMs);
+
+    return ( left > 0 ) ? left : 0;
+}
+
+
+const char *batchFinish(size_t *pLen)
+{
+    memcpy(&gBatch[gBatchLen], gBatchTail, BATCH_TAIL_LEN);
+    *pLen = gBatchLen + BATCH_TAIL_LEN;
+
+    return gBatch;
+}
+
+
+void batchReset(void)
+{
+    gBatchLen = 0;
+    gBatchCount = 0;
+}
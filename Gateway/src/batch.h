@@ -0,0 +1,139 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BATCH_H__
+#define  BATCH_H__
+
+/** @file
+ * @brief The batch packs many samples (from one or many broadcasters) into
+ * one MQTT message, so that a single publish (one AT round-trip to NINA-W156)
+ * carries all of them.
+ *
+ * With CONFIG_AQM_PAYLOAD_JSON the message is a JSON object with an array of
+ * samples:
+ *
+ *   {"samples":[{"dev":"C0:11:22:33:44:55","id":12,"c02level":...,
+ *                "humidity":...,"temperature":...,"t":1665000000123}, ...]}
+ *
+ * With CONFIG_AQM_PAYLOAD_CBOR the message is the CBOR (RFC 8949) encoding of
+ * a map with the schema version and an array of samples, where every sample
+ * is an array with a fixed field order (schema version 2):
+ *
+ *   {"v":2,"s":[[h'C01122334455', 12, co2, humidity, temperature, t], ...]}
+ *
+ * The address is a 6 byte string (most significant byte first), the message
+ * id an unsigned integer and the measurements single precision floats.
+ * The time "t" of the measurement (msec since the Unix epoch, see
+ * time_sync.h) is left out in JSON, and null in CBOR, when not known.
+ *
+ * With CONFIG_AQM_UPLINK_AGGREGATE the batch holds rollups instead (see
+ * aggregate.h), every value as an array of statistics [min,max,mean,last]:
+ *
+ *   {"rollups":[{"dev":"C0:11:22:33:44:55","win":60,"n":12,"id":345,
+ *                "c02level":[...],"humidity":[...],"temperature":[...],"t":...}, ...]}
+ *
+ *   {"v":2,"r":[[h'C01122334455', 60, 12, 345, [co2 ...], [hum ...], [temp ...], t], ...]}
+ *
+ * where the time is the one of the last sample of the window.
+ *
+ * A batch should be flushed (published and reset) when it holds
+ * CONFIG_AQM_BATCH_MAX_SAMPLES samples, when the next sample does not fit in
+ * CONFIG_AQM_BATCH_MAX_BYTES, or when its oldest sample has waited
+ * CONFIG_AQM_BATCH_MAX_AGE_MS in it, whichever comes first.
+ *
+ * Only used by the uplink thread, not thread safe, but for
+ * batchEncodeSingle() which only uses its arguments.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bluetooth/addr.h>
+
+#include "aqm_sample.h"
+#include "aggregate.h"
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Adds a sample to the batch.
+ *
+ * @param pSample  The sample to be added.
+ * @param pAddr    The Bluetooth address of the broadcaster of the sample.
+ * @return         zero on success, -ENOSPC if the sample does not fit in
+ *                 the bytes left (flush the batch and add it again), or
+ *                 -EINVAL if it does not fit even in an empty batch.
+ */
+int batchAdd(const aqmSample_t *pSample, const bt_addr_le_t *pAddr);
+
+/** Adds a rollup to the batch (CONFIG_AQM_UPLINK_AGGREGATE only).
+ *
+ * @param pRollup  The rollup to be added.
+ * @param pAddr    The Bluetooth address of the broadcaster of the rollup.
+ * @return         zero on success, -ENOSPC if the rollup does not fit in
+ *                 the bytes left (flush the batch and add it again), or
+ *                 -EINVAL if it does not fit even in an empty batch.
+ */
+int batchAddRollup(const aggregateRollup_t *pRollup, const bt_addr_le_t *pAddr);
+
+/** Encodes a message holding a single sample, in the same format as a
+ *  batch of samples, into another buffer (the batch is not changed).
+ *
+ * @param pSample  The sample.
+ * @param pAddr    The Bluetooth address of the broadcaster of the sample.
+ * @param pBuf     Where to write the message (not null terminated).
+ * @param size     Size of pBuf.
+ * @return         the length of the message, or negative if it does not fit.
+ */
+int batchEncodeSingle(const aqmSample_t *pSample, const bt_addr_le_t *pAddr,
+                      char *pBuf, size_t size);
+
+/** Gets the number of samples in the batch.
+ *
+ * @return  the number of samples.
+ */
+uint32_t batchCount(void);
+
+/** Checks if the batch holds the maximum number of samples.
+ *
+ * @return  true if the batch should be flushed.
+ */
+bool batchIsFull(void);
+
+/** Gets the time left until the batch should be flushed because of its age.
+ *
+ * @param nowMs  Current uptime (msec).
+ * @return       msec until the oldest sample has waited the maximum age, zero if
+ *               already reached, or -1 if the batch is empty.
+ */
+int32_t batchTimeLeftMs(uint32_t nowMs);
+
+/** Closes the batch message, ready to be published. No more samples can be
+ *  added until batchReset() is called.
+ *
+ * @param pLen  Set to the length of the message.
+ * @return      the message (not null terminated).
+ */
+const char *batchFinish(size_t *pLen);
+
+/** Empties the batch.
+ */
+void batchReset(void);
+
+
+#endif // BATCH_H__
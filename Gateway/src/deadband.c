@@ -0,0 +1,141 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** @file
+ * @brief Contains the implementation of the API described in deadband.h
+ */
+
+#include "deadband.h"
+
+#if defined(CONFIG_AQM_DEADBAND)
+
+#include <zephyr.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+#define DEADBAND_HEARTBEAT_MS   (CONFIG_AQM_DEADBAND_HEARTBEAT_S * 1000U)
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Thresholds of a value */
+typedef struct{
+    float absolute;     /**< Absolute change, 0 when disabled */
+    float relative;     /**< Change relative to the last value, 0 when disabled */
+}deadbandThreshold_t;
+
+/** State of a broadcaster */
+typedef struct{
+    float co2;              /**< Last values forwarded */
+    float humidity;
+    float temperature;
+    uint32_t lastMs;        /**< Uptime (msec) the last sample forwarded was received */
+    bool valid;             /**< A sample was forwarded */
+    deadbandStats_t stats;
+}deviceDeadband_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static const deadbandThreshold_t gCo2Threshold = {
+    .absolute = CONFIG_AQM_DEADBAND_CO2_PPM,
+    .relative = CONFIG_AQM_DEADBAND_CO2_PERMILLE / 1000.0f
+};
+
+static const deadbandThreshold_t gHumidityThreshold = {
+    .absolute = CONFIG_AQM_DEADBAND_HUMIDITY_CENTI / 100.0f,
+    .relative = CONFIG_AQM_DEADBAND_HUMIDITY_PERMILLE / 1000.0f
+};
+
+static const deadbandThreshold_t gTemperatureThreshold = {
+    .absolute = CONFIG_AQM_DEADBAND_TEMPERATURE_CENTI / 100.0f,
+    .relative = CONFIG_AQM_DEADBAND_TEMPERATURE_PERMILLE / 1000.0f
+};
+
+static deviceDeadband_t gDeadband[CONFIG_AQM_MAX_DEVICES];
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+static float deadbandAbs(float value)
+{
+    return ( value < 0.0f ) ? -value : value;
+}
+
+
+/** Checks if a value changed enough since the last one forwarded */
+static bool deadbandExceeded(const deadbandThreshold_t *pThreshold, float last, float value)
+{
+    float change = deadbandAbs(value - last);
+
+    if( ( pThreshold->absolute > 0.0f ) && ( change >= pThreshold->absolute ) ){
+        return true;
+    }
+
+    return ( pThreshold->relative > 0.0f ) && ( change >= pThreshold->relative * deadbandAbs(last) );
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+bool deadbandCheck(const aqmSample_t *pSample)
+{
+    deviceDeadband_t *pState = &gDeadband[pSample->deviceIndex];
+    const aqmMeasurement_t *pMeas = &pSample->meas;
+
+    if( !pState->valid ||
+        deadbandExceeded(&gCo2Threshold, pState->co2, pMeas->co2) ||
+        deadbandExceeded(&gHumidityThreshold, pState->humidity, pMeas->humidity) ||
+        deadbandExceeded(&gTemperatureThreshold, pState->temperature, pMeas->temperature) ){
+        pState->stats.forwarded++;
+    }
+    else if( ( DEADBAND_HEARTBEAT_MS > 0 ) && ( pSample->rxTimeMs - pState->lastMs >= DEADBAND_HEARTBEAT_MS ) ){
+        // nothing changed for a while, show that the broadcaster is alive
+        pState->stats.heartbeats++;
+    }
+    else{
+        pState->stats.suppressed++;
+        return false;
+    }
+
+    pState->co2 = pMeas->co2;
+    pState->humidity = pMeas->humidity;
+    pState->temperature = pMeas->temperature;
+    pState->lastMs = pSample->rxTimeMs;
+    pState->valid = true;
+
+    return true;
+}
+
+
+void deadbandGetStats(int deviceIndex, deadbandStats_t *pStats)
+{
+    *pStats = gDeadband[deviceIndex].stats;
+}
+
+#endif // CONFIG_AQM_DEADBAND
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEADBAND_H__
+#define  DEADBAND_H__
+
+/** @file
+ * @brief The deadband decides which samples are worth publishing (report by
+ * exception, CONFIG_AQM_DEADBAND): a sample is only forwarded when one of
+ * its values (CO2, humidity, temperature) differs enough from the last one
+ * forwarded for the same broadcaster, or when nothing was forwarded for
+ * CONFIG_AQM_DEADBAND_HEARTBEAT_S (heartbeat, confirms the broadcaster is
+ * alive).
+ *
+ * Every value has an absolute threshold and a relative one (permille of the
+ * last value forwarded), either can be disabled (0). A value differs enough
+ * when the change reaches any of its enabled thresholds.
+ *
+ * Per-device state is kept in arrays indexed by the device table index.
+ * Only used by the uplink thread, the statistics can be read by any thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the deadband of a broadcaster */
+typedef struct{
+    uint32_t forwarded;     /**< Samples forwarded because a value changed enough */
+    uint32_t heartbeats;    /**< Samples forwarded because of the heartbeat */
+    uint32_t suppressed;    /**< Samples not forwarded */
+}deadbandStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Checks if a sample should be forwarded, and if so remembers its values
+ *  as the last ones forwarded for its broadcaster. The first sample of a
+ *  broadcaster is always forwarded.
+ *
+ * @param pSample  The sample.
+ * @return         true if the sample should be forwarded.
+ */
+bool deadbandCheck(const aqmSample_t *pSample);
+
+/** Gets the deadband statistics of a broadcaster.
+ *
+ * @param deviceIndex  Index of the broadcaster in the device table.
+ * @param pStats       Where the statistics are copied.
+ */
+void deadbandGetStats(int deviceIndex, deadbandStats_t *pStats);
+
+
+#endif // DEADBAND_H__
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in dedup_window.h
+ */
+
+#include "dedup_window.h"
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Restarts the window with a single message id received */
+static void dedupWindowRestart(dedupWindow_t *pWindow, uint16_t bootEpoch, uint32_t messageId)
+{
+    pWindow->highestId = messageId;
+    pWindow->bitmap = 1;
+    pWindow->bootEpoch = bootEpoch;
+    pWindow->valid = true;
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+dedupResult_t dedupWindowCheck(dedupWindow_t *pWindow, uint16_t bootEpoch, uint32_t messageId)
+{
+    uint32_t distance;
+
+    // first message from this broadcaster
+    if( !pWindow->valid ){
+        dedupWindowRestart(pWindow, bootEpoch, messageId);
+        return DEDUP_NEW;
+    }
+
+    // the broadcaster has rebooted, its message ids start over
+    if( bootEpoch != pWindow->bootEpoch ){
+        dedupWindowRestart(pWindow, bootEpoch, messageId);
+        return DEDUP_NEW_REBOOT;
+    }
+
+    // newer than anything received: slide the window forward
+    if( messageId > pWindow->highestId ){
+        distance = messageId - pWindow->highestId;
+        if( distance < DEDUP_WINDOW_SIZE ){
+            pWindow->bitmap = (pWindow->bitmap << distance) | 1;
+        }
+        else{
+            pWindow->bitmap = 1;
+        }
+        pWindow->highestId = messageId;
+        return DEDUP_NEW;
+    }
+
+    // older (or the same): look it up in the window
+    distance = pWindow->highestId - messageId;
+    if( distance < DEDUP_WINDOW_SIZE ){
+        if( pWindow->bitmap & (1UL << distance) ){
+            return DEDUP_DUPLICATE;
+        }
+        pWindow->bitmap |= (1UL << distance);
+        return DEDUP_NEW_REORDERED;
+    }
+
+    // behind the window: a broadcaster that does not send a boot epoch has
+    // rebooted (reordering never goes that far), one that does only if it
+    // is far behind without an epoch change
+    if( ( bootEpoch == DEDUP_BOOT_EPOCH_NONE ) || ( distance >= DEDUP_RESYNC_DISTANCE ) ){
+        dedupWindowRestart(pWindow, bootEpoch, messageId);
+        return DEDUP_NEW_REBOOT;
+    }
+
+    return DEDUP_STALE;
+}
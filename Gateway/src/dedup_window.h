@@ -0,0 +1,107 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEDUP_WINDOW_H__
+#define  DEDUP_WINDOW_H__
+
+/** @file
+ * @brief Sliding-window duplicate suppression for the measurements of a
+ * broadcaster. Each broadcaster has a window which remembers which of the
+ * last DEDUP_WINDOW_SIZE message ids (counting back from the highest id
+ * received) have already been received, so every message id is accepted
+ * exactly once even if advertisements arrive interleaved or reordered.
+ *
+ * The boot epoch carried in the advertisement changes every time the
+ * broadcaster reboots. When it changes, the window restarts, so the message
+ * ids starting again from 1 are not mistaken for duplicates. Broadcasters
+ * which do not send a boot epoch are assumed to have rebooted when a
+ * message id is older than the window.
+ *
+ * A check is a few compares and one shift: constant time, safe to use in
+ * the scan callback.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Number of message ids remembered by the window (bits of the bitmap) */
+#define DEDUP_WINDOW_SIZE       32
+
+/** Boot epoch of broadcasters which do not send one */
+#define DEDUP_BOOT_EPOCH_NONE   0
+
+/** If a message id is this much lower than the highest id received (and the
+ * boot epoch is the same) the broadcaster is assumed to have rebooted
+ * anyway. For broadcasters without boot epoch any message id behind the
+ * window is a reboot */
+#define DEDUP_RESYNC_DISTANCE   1024
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Result of a window check */
+typedef enum{
+    DEDUP_NEW = 0,          /**< New message id, in order */
+    DEDUP_NEW_REORDERED,    /**< New message id, older than the highest received */
+    DEDUP_NEW_REBOOT,       /**< New message id, the broadcaster has rebooted */
+    DEDUP_DUPLICATE,        /**< Message id already received */
+    DEDUP_STALE             /**< Message id too old to tell, dropped */
+}dedupResult_t;
+
+/** The window of a broadcaster. Zero initialized means "nothing received" */
+typedef struct{
+    uint32_t highestId;     /**< Highest message id received */
+    uint32_t bitmap;        /**< Bit n set: message id (highestId - n) received */
+    uint16_t bootEpoch;     /**< Boot epoch of the broadcaster */
+    bool valid;             /**< At least one message has been received */
+}dedupWindow_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Checks a message id against the window of a broadcaster and, if it is
+ *  new, marks it as received.
+ *
+ * @param pWindow    The window of the broadcaster.
+ * @param bootEpoch  The boot epoch in the advertisement.
+ * @param messageId  The message id in the advertisement.
+ * @return           DEDUP_NEW, DEDUP_NEW_REORDERED or DEDUP_NEW_REBOOT if the
+ *                   message should be forwarded, DEDUP_DUPLICATE or
+ *                   DEDUP_STALE if it should be dropped.
+ */
+dedupResult_t dedupWindowCheck(dedupWindow_t *pWindow, uint16_t bootEpoch, uint32_t messageId);
+
+/** Tells if a window check result means that the message is new.
+ *
+ * @param result  A result of dedupWindowCheck().
+ * @return        true if the message should be forwarded.
+ */
+static inline bool dedupIsNew(dedupResult_t result)
+{
+    return result <= DEDUP_NEW_REBOOT;
+}
+
+
+#endif // DEDUP_WINDOW_H__
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in device_table.h
+ */
+
+#include "device_table.h"
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <string.h>
+#include <errno.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Number of slots of the hash index. Twice the number of devices, so the
+ * load factor never exceeds 50% and probe sequences stay short */
+#define DEVICE_TABLE_SLOTS      (2 * CONFIG_AQM_MAX_DEVICES)
+
+/** Value of an empty slot in the hash index */
+#define DEVICE_TABLE_SLOT_EMPTY 0
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** The device entries, in the order the devices were found */
+static deviceEntry_t gDevices[CONFIG_AQM_MAX_DEVICES];
+
+/** The hash index. Each slot holds (device index + 1), or
+ * DEVICE_TABLE_SLOT_EMPTY */
+static uint16_t gSlots[DEVICE_TABLE_SLOTS];
+
+/** Number of devices in the table. Set after the entry is written, so
+ * readers in other threads only see complete entries */
+static atomic_t gCount = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** FNV-1a hash of the address (type and value) */
+static uint32_t deviceTableHash(const bt_addr_le_t *pAddr)
+{
+    uint32_t hash = 2166136261U;
+
+    hash = (hash ^ pAddr->type) * 16777619U;
+    for( size_t i = 0; i < sizeof(pAddr->a.val); i++ ){
+        hash = (hash ^ pAddr->a.val[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+/** Probes the hash index for an address. Returns the slot holding the
+ * address or the empty slot where it should be inserted */
+static uint32_t deviceTableProbe(const bt_addr_le_t *pAddr)
+{
+    uint32_t slot = deviceTableHash(pAddr) % DEVICE_TABLE_SLOTS;
+
+    // The index always has empty slots (load factor <= 50%), so this ends
+    while( gSlots[slot] != DEVICE_TABLE_SLOT_EMPTY ){
+        if( bt_addr_le_cmp(&gDevices[gSlots[slot] - 1].addr, pAddr) == 0 ){
+            break;
+        }
+        slot = (slot + 1) % DEVICE_TABLE_SLOTS;
+    }
+
+    return slot;
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+int deviceTableFind(const bt_addr_le_t *pAddr)
+{
+    uint32_t slot = deviceTableProbe(pAddr);
+
+    if( gSlots[slot] == DEVICE_TABLE_SLOT_EMPTY ){
+        return -ENOENT;
+    }
+
+    return gSlots[slot] - 1;
+}
+
+
+int deviceTableAdd(const bt_addr_le_t *pAddr)
+{
+    uint32_t slot = deviceTableProbe(pAddr);
+    uint32_t count = (uint32_t)atomic_get(&gCount);
+
+    if( gSlots[slot] != DEVICE_TABLE_SLOT_EMPTY ){
+        // already in the table
+        return gSlots[slot] - 1;
+    }
+
+    if( count >= CONFIG_AQM_MAX_DEVICES ){
+        return -ENOMEM;
+    }
+
+    memset(&gDevices[count], 0, sizeof(gDevices[count]));
+    bt_addr_le_copy(&gDevices[count].addr, pAddr);
+    gSlots[slot] = (uint16_t)(count + 1);
+
+    // publish the new entry
+    atomic_set(&gCount, (atomic_val_t)(count + 1));
+
+    return (int)count;
+}
+
+
+deviceEntry_t *deviceTableGet(int index)
+{
+    if( (index < 0) || (index >= (int)atomic_get(&gCount)) ){
+        return NULL;
+    }
+
+    return &gDevices[index];
+}
+
+
+uint32_t deviceTableCount(void)
+{
+    return (uint32_t)atomic_get(&gCount);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_TABLE_H__
+#define  DEVICE_TABLE_H__
+
+/** @file
+ * @brief The device table holds the state of every sensor broadcaster the
+ * Gateway has found. It is a fixed-capacity (CONFIG_AQM_MAX_DEVICES) table
+ * keyed by the Bluetooth address of the broadcaster, using an open-addressing
+ * (linear probing) hash index, so lookups from the scan callback are O(1)
+ * and never allocate.
+ *
+ * Entries are never removed, so the index of a device (0..count-1) is stable
+ * and can be used by other modules to keep per-device data in plain arrays.
+ *
+ * Only the Bluetooth RX thread (scan callback) inserts/updates entries. Other
+ * threads may read them (e.g. for statistics), entries 0..count-1 are always
+ * fully initialized.
+ */
+
+#include <zephyr.h>
+#include <stdint.h>
+#include <bluetooth/bluetooth.h>
+
+#include "dedup_window.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** State of a sensor broadcaster */
+typedef struct{
+    bt_addr_le_t addr;      /**< Bluetooth address of the broadcaster */
+    uint32_t lastMsgId;     /**< Message id of the last new measurement received */
+    dedupWindow_t window;   /**< Message ids recently received */
+    int8_t rssi;            /**< RSSI of the last advertisement received */
+    uint32_t lastSeenMs;    /**< Uptime (msec) of the last advertisement received */
+    uint32_t advCount;      /**< Advertisements received from this device */
+    uint32_t sampleCount;   /**< New measurements forwarded to the uplink */
+    uint32_t duplicates;    /**< Measurements dropped as already received */
+    uint32_t reordered;     /**< New measurements received out of order */
+    uint32_t stale;         /**< Measurements dropped as too old for the window */
+    uint32_t reboots;       /**< Broadcaster reboots detected */
+}deviceEntry_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Finds a device in the table.
+ *
+ * @param pAddr  The Bluetooth address of the device.
+ * @return       the index of the device or negative if not in the table.
+ */
+int deviceTableFind(const bt_addr_le_t *pAddr);
+
+/** Adds a device to the table. If it is already there its index is returned.
+ *  Should only be called from the Bluetooth RX thread.
+ *
+ * @param pAddr  The Bluetooth address of the device.
+ * @return       the index of the device or -ENOMEM if the table is full.
+ */
+int deviceTableAdd(const bt_addr_le_t *pAddr);
+
+/** Gets a device entry.
+ *
+ * @param index  The index of the device as returned by deviceTableFind/Add.
+ * @return       pointer to the entry or NULL if the index is not valid.
+ */
+deviceEntry_t *deviceTableGet(int index);
+
+/** Gets the number of devices in the table.
+ *
+ * @return  the number of devices.
+ */
+uint32_t deviceTableCount(void);
+
+
+#endif // DEVICE_TABLE_H__
@@ -0,0 +1,441 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/** @file
+ * @brief Contains the implementation of the API described in flash_log.h
+ */
+
+#include "flash_log.h"
+
+#if defined(CONFIG_AQM_FLASH_LOG)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <sys/crc.h>
+#include <storage/flash_map.h>
+#include <fs/fcb.h>
+#include <string.h>
+#include <errno.h>
+
+#include "time_sync.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+#define FLASH_LOG_AREA_ID       FLASH_AREA_ID(storage)
+
+/** Written in every sector header by the FCB, a different magic or version
+ * (e.g. another application in the partition) makes the log start empty.
+ * The version changes with every layout of the sample record: 1 the first
+ * one (40 bytes), 2 with the timing of the broadcaster, 3 with the epoch
+ * time too (52 bytes) */
+#define FLASH_LOG_MAGIC         0x4C4D5141  // "AQML"
+#define FLASH_LOG_VERSION       3
+
+#define FLASH_LOG_TYPE_SAMPLE   'S'
+#define FLASH_LOG_TYPE_CURSOR   'C'
+
+/** Records are a multiple of the flash write block size (4 bytes) */
+#define FLASH_LOG_ALIGN         4
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Record of a sample (52 bytes) */
+typedef struct __packed{
+    uint16_t crc;           /**< CRC16 of the rest of the record */
+    uint8_t type;           /**< FLASH_LOG_TYPE_SAMPLE */
+    int8_t rssi;            /**< RSSI of the advertisement */
+    uint32_t seq;           /**< Sequence number, ascending */
+    uint32_t rxTimeMs;      /**< Uptime (msec) when the sample was received */
+    uint64_t timeMs;        /**< Epoch time (msec) of the measurement, zero if not known */
+    aqmMeasurement_t meas;  /**< The measurement data of the broadcaster */
+    bt_addr_le_t addr;      /**< Bluetooth address of the broadcaster */
+    uint8_t reserved[3];
+}flashLogSample_t;
+
+/** Record of the cursor (8 bytes) */
+typedef struct __packed{
+    uint16_t crc;           /**< CRC16 of the rest of the record */
+    uint8_t type;           /**< FLASH_LOG_TYPE_CURSOR */
+    uint8_t reserved;
+    uint32_t seq;           /**< Sequence number of the last sample published */
+}flashLogCursor_t;
+
+typedef union{
+    flashLogSample_t sample;
+    flashLogCursor_t cursor;
+}flashLogRecord_t;
+
+BUILD_ASSERT(sizeof(flashLogSample_t) % FLASH_LOG_ALIGN == 0, "Sample record not aligned");
+BUILD_ASSERT(sizeof(flashLogSample_t) == 52, "Sample record changed: change FLASH_LOG_VERSION");
+BUILD_ASSERT(sizeof(flashLogCursor_t) % FLASH_LOG_ALIGN == 0, "Cursor record not aligned");
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static struct flash_sector gSectors[CONFIG_AQM_FLASH_LOG_MAX_SECTORS];
+static struct fcb gFcb;
+static bool gReady;
+
+/** Sequence number of the next sample appended */
+static uint32_t gNextSeq = 1;
+
+/** Sequence number of the first sample appended since boot */
+static uint32_t gBootSeq = 1;
+
+/** Sequence number of the last sample published (persisted) */
+static uint32_t gCursor;
+
+/** Position (entry) and sequence number of the last sample read. A NULL
+ * sector means before the first entry */
+static struct fcb_entry gReadLoc;
+static uint32_t gReadSeq;
+
+/** Samples up to this sequence number are already counted as lost */
+static uint32_t gLostSeq;
+
+static atomic_t gStored = ATOMIC_INIT(0);
+static atomic_t gReplayed = ATOMIC_INIT(0);
+static atomic_t gCommitted = ATOMIC_INIT(0);
+static atomic_t gErased = ATOMIC_INIT(0);
+static atomic_t gLost = ATOMIC_INIT(0);
+static atomic_t gCrcErrors = ATOMIC_INIT(0);
+static atomic_t gUnread = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** CRC16 of a record, the crc field itself excluded */
+static uint16_t flashLogCrc(const void *pRecord, size_t len)
+{
+    return crc16_ccitt(0xFFFF, (const uint8_t *)pRecord + sizeof(uint16_t),
+                       len - sizeof(uint16_t));
+}
+
+
+/** Reads and checks the record of an entry. Returns its type, or negative
+ * if the record is not valid */
+static int flashLogRead(struct fcb_entry *pLoc, flashLogRecord_t *pRecord)
+{
+    uint16_t len = pLoc->fe_data_len;
+
+    if( ( len != sizeof(flashLogSample_t) ) && ( len != sizeof(flashLogCursor_t) ) ){
+        atomic_inc(&gCrcErrors);
+        return -EINVAL;
+    }
+
+    if( flash_area_read(gFcb.fap, FCB_ENTRY_FA_DATA_OFF((*pLoc)), pRecord, len) != 0 ){
+        return -EIO;
+    }
+
+    if( pRecord->sample.crc != flashLogCrc(pRecord, len) ){
+        atomic_inc(&gCrcErrors);
+        return -EBADMSG;
+    }
+
+    if( ( pRecord->sample.type == FLASH_LOG_TYPE_SAMPLE ) && ( len == sizeof(flashLogSample_t) ) ){
+        return FLASH_LOG_TYPE_SAMPLE;
+    }
+    if( ( pRecord->cursor.type == FLASH_LOG_TYPE_CURSOR ) && ( len == sizeof(flashLogCursor_t) ) ){
+        return FLASH_LOG_TYPE_CURSOR;
+    }
+
+    return -EINVAL;
+}
+
+
+/** Updates the number of samples not read yet */
+static void flashLogUpdateUnread(void)
+{
+    atomic_set(&gUnread, (atomic_val_t)( gNextSeq - 1 - gReadSeq ));
+}
+
+
+/** Moves the read position just after the sample afterSeq. The samples
+ * between it and the first sample found after it were erased unread */
+static void flashLogSeek(uint32_t afterSeq)
+{
+    struct fcb_entry loc = { 0 };
+    struct fcb_entry prev = { 0 };
+    flashLogRecord_t record;
+
+    gReadSeq = gNextSeq - 1;
+
+    while( fcb_getnext(&gFcb, &loc) == 0 ){
+        if( ( flashLogRead(&loc, &record) == FLASH_LOG_TYPE_SAMPLE ) &&
+            ( record.sample.seq > afterSeq ) ){
+            uint32_t firstSeq = record.sample.seq;
+
+            if( firstSeq - 1 > MAX(afterSeq, gLostSeq) ){
+                atomic_add(&gLost, (atomic_val_t)( firstSeq - 1 - MAX(afterSeq, gLostSeq) ));
+                gLostSeq = firstSeq - 1;
+            }
+            gReadSeq = firstSeq - 1;
+            break;
+        }
+        prev = loc;
+    }
+
+    gReadLoc = prev;
+    flashLogUpdateUnread();
+}
+
+
+/** Appends a record, erasing the oldest sector if the log is full */
+static int flashLogAppend(flashLogRecord_t *pRecord, uint16_t len)
+{
+    struct fcb_entry loc;
+    int err;
+
+    pRecord->sample.crc = flashLogCrc(pRecord, len);
+
+    err = fcb_append(&gFcb, len, &loc);
+    if( err == -ENOSPC ){
+        err = fcb_rotate(&gFcb);
+        if( err ){
+            return err;
+        }
+        atomic_inc(&gErased);
+
+        // The erased sector may have held the read position and the last
+        // cursor record: find the read position again (without reading
+        // again what is already in the batch) and write the cursor again
+        // before the new record
+        flashLogSeek(gReadSeq);
+        if( pRecord->sample.type != FLASH_LOG_TYPE_CURSOR ){
+            flashLogCommit(gCursor);
+        }
+
+        err = fcb_append(&gFcb, len, &loc);
+    }
+    if( err ){
+        return err;
+    }
+
+    err = flash_area_write(gFcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), pRecord, len);
+    if( err ){
+        return err;
+    }
+
+    return fcb_append_finish(&gFcb, &loc);
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+int flashLogInit(void)
+{
+    uint32_t sectorCount = ARRAY_SIZE(gSectors);
+    struct fcb_entry loc = { 0 };
+    flashLogRecord_t record;
+    uint32_t lastSeq = 0;
+    int err;
+
+    err = flash_area_get_sectors(FLASH_LOG_AREA_ID, &sectorCount, gSectors);
+    if( err ){
+        printk("Flash log: storage partition not usable (err %d)\r\n", err);
+        return err;
+    }
+
+    gFcb.f_magic = FLASH_LOG_MAGIC;
+    gFcb.f_version = FLASH_LOG_VERSION;
+    gFcb.f_sector_cnt = (uint8_t)sectorCount;
+    gFcb.f_scratch_cnt = 0;
+    gFcb.f_sectors = gSectors;
+
+    err = fcb_init(FLASH_LOG_AREA_ID, &gFcb);
+    if( err ){
+        // not an FCB with our magic/version, start with an empty log
+        const struct flash_area *pArea;
+
+        printk("Flash log: erasing the storage partition (err %d)\r\n", err);
+        err = flash_area_open(FLASH_LOG_AREA_ID, &pArea);
+        if( err == 0 ){
+            err = flash_area_erase(pArea, 0, pArea->fa_size);
+            flash_area_close(pArea);
+        }
+        if( err == 0 ){
+            err = fcb_init(FLASH_LOG_AREA_ID, &gFcb);
+        }
+        if( err ){
+            return err;
+        }
+    }
+
+    // find the last sequence number and the last cursor written
+    while( fcb_getnext(&gFcb, &loc) == 0 ){
+        switch( flashLogRead(&loc, &record) ){
+            case FLASH_LOG_TYPE_SAMPLE:
+                lastSeq = MAX(lastSeq, record.sample.seq);
+                break;
+            case FLASH_LOG_TYPE_CURSOR:
+                gCursor = MAX(gCursor, record.cursor.seq);
+                break;
+            default:
+                break;
+        }
+    }
+
+    gNextSeq = MAX(lastSeq, gCursor) + 1;
+    gBootSeq = gNextSeq;
+    gLostSeq = gCursor;
+    flashLogSeek(gCursor);
+    gReady = true;
+
+    printk("Flash log: %u sectors, %u samples to replay\r\n",
+            sectorCount, (uint32_t)atomic_get(&gUnread));
+
+    return 0;
+}
+
+
+int flashLogPut(const aqmSample_t *pSample, const bt_addr_le_t *pAddr)
+{
+    flashLogRecord_t record = { 0 };
+    int err;
+
+    if( !gReady ){
+        return -ENODEV;
+    }
+
+    record.sample.type = FLASH_LOG_TYPE_SAMPLE;
+    record.sample.rssi = pSample->rssi;
+    record.sample.seq = gNextSeq;
+    record.sample.rxTimeMs = pSample->rxTimeMs;
+    record.sample.timeMs = pSample->timeMs;
+    record.sample.meas = pSample->meas;
+    record.sample.addr = *pAddr;
+
+    err = flashLogAppend(&record, sizeof(record.sample));
+    if( err ){
+        return err;
+    }
+
+    gNextSeq++;
+    atomic_inc(&gStored);
+    flashLogUpdateUnread();
+
+    return 0;
+}
+
+
+bool flashLogGet(aqmSample_t *pSample, bt_addr_le_t *pAddr, uint32_t *pSeq)
+{
+    struct fcb_entry loc = gReadLoc;
+    flashLogRecord_t record;
+
+    if( !gReady ){
+        return false;
+    }
+
+    while( fcb_getnext(&gFcb, &loc) == 0 ){
+        gReadLoc = loc;
+
+        // cursor records and samples already read are skipped
+        if( ( flashLogRead(&loc, &record) != FLASH_LOG_TYPE_SAMPLE ) ||
+            ( record.sample.seq <= gReadSeq ) ){
+            continue;
+        }
+
+        gReadSeq = record.sample.seq;
+        flashLogUpdateUnread();
+        atomic_inc(&gReplayed);
+
+        memset(pSample, 0, sizeof(*pSample));
+        pSample->meas = record.sample.meas;
+        pSample->rxTimeMs = record.sample.rxTimeMs;
+        pSample->timeMs = record.sample.timeMs;
+        pSample->rssi = record.sample.rssi;
+
+#if defined(CONFIG_AQM_TIME_SYNC)
+        // stored before the clock was synced: the reception time can only
+        // be converted if it is an uptime of this boot
+        if( ( pSample->timeMs == 0 ) && ( record.sample.seq >= gBootSeq ) ){
+            pSample->timeMs = timeSyncSampleMs(pSample);
+        }
+#endif
+        *pAddr = record.sample.addr;
+        *pSeq = record.sample.seq;
+
+        return true;
+    }
+
+    // nothing left, the samples not found were lost
+    gReadSeq = gNextSeq - 1;
+    flashLogUpdateUnread();
+
+    return false;
+}
+
+
+bool flashLogIsEmpty(void)
+{
+    return !gReady || ( gReadSeq + 1 >= gNextSeq );
+}
+
+
+void flashLogCommit(uint32_t seq)
+{
+    flashLogRecord_t record = { 0 };
+
+    if( !gReady ){
+        return;
+    }
+
+    gCursor = MAX(gCursor, seq);
+
+    record.cursor.type = FLASH_LOG_TYPE_CURSOR;
+    record.cursor.seq = gCursor;
+
+    if( flashLogAppend(&record, sizeof(record.cursor)) == 0 ){
+        atomic_inc(&gCommitted);
+    }
+}
+
+
+void flashLogRewind(void)
+{
+    if( gReady ){
+        flashLogSeek(gCursor);
+    }
+}
+
+
+void flashLogGetStats(flashLogStats_t *pStats)
+{
+    pStats->stored = (uint32_t)atomic_get(&gStored);
+    pStats->replayed = (uint32_t)atomic_get(&gReplayed);
+    pStats->committed = (uint32_t)atomic_get(&gCommitted);
+    pStats->erased = (uint32_t)atomic_get(&gErased);
+    pStats->lost = (uint32_t)atomic_get(&gLost);
+    pStats->crcErrors = (uint32_t)atomic_get(&gCrcErrors);
+    pStats->unread = (uint32_t)atomic_get(&gUnread);
+}
+
+#endif // CONFIG_AQM_FLASH_LOG
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLASH_LOG_H__
+#define  FLASH_LOG_H__
+
+/** @file
+ * @brief The flash log keeps the samples received while the link to the
+ * broker is down in the storage partition of the internal flash, so they
+ * survive long outages and reboots of the Gateway (store-and-forward, see
+ * also store_ring.h for the RAM only version).
+ *
+ * The log is a Zephyr Flash Circular Buffer (FCB): records are only ever
+ * appended, a sector is erased only when the log is full (the oldest one,
+ * its samples are lost). Every record is protected by a CRC16 (besides the
+ * CRC8 of the FCB entry) and carries a sequence number, the uptime it was
+ * received at, its epoch time (if the clock was synced, see time_sync.h)
+ * and the address of its broadcaster (neither the uptime nor the device
+ * table index survive a reboot).
+ *
+ * The read cursor (sequence number of the last sample published) is
+ * persisted in the log as well, as a small cursor record appended after
+ * every published batch, so after a power loss the replay resumes after the
+ * last batch published.
+ *
+ * Only used by the uplink thread, not thread safe (except the statistics).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bluetooth/addr.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the flash log */
+typedef struct{
+    uint32_t stored;        /**< Samples appended to the log */
+    uint32_t replayed;      /**< Samples read out of the log to be published */
+    uint32_t committed;     /**< Cursor records written (one per published batch) */
+    uint32_t erased;        /**< Sectors erased because the log was full */
+    uint32_t lost;          /**< Samples erased before they were published */
+    uint32_t crcErrors;     /**< Records skipped because of a bad CRC */
+    uint32_t unread;        /**< Samples in the log not published yet */
+}flashLogStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Opens the log in the storage partition and finds the samples not
+ *  published yet (e.g. before a reboot), which are then replayed first.
+ *
+ * @return  zero on success else negative error code.
+ */
+int flashLogInit(void);
+
+/** Appends a sample to the log.
+ *
+ * @param pSample  The sample.
+ * @param pAddr    The Bluetooth address of the broadcaster of the sample.
+ * @return         zero on success else negative error code.
+ */
+int flashLogPut(const aqmSample_t *pSample, const bt_addr_le_t *pAddr);
+
+/** Reads the next sample not published yet. The cursor is not moved, see
+ *  flashLogCommit().
+ *
+ * @param pSample  Where the sample is copied. The device index is not valid.
+ * @param pAddr    Where the address of the broadcaster is copied.
+ * @param pSeq     Set to the sequence number of the sample.
+ * @return         true on success, false if there is no sample left.
+ */
+bool flashLogGet(aqmSample_t *pSample, bt_addr_le_t *pAddr, uint32_t *pSeq);
+
+/** Checks if all the samples in the log have been read.
+ *
+ * @return  true if there is nothing to replay.
+ */
+bool flashLogIsEmpty(void);
+
+/** Persists the cursor: the samples up to seq have been published.
+ *
+ * @param seq  Sequence number of the last sample published.
+ */
+void flashLogCommit(uint32_t seq);
+
+/** Reads again from the cursor, e.g. after the publish of the samples read
+ *  failed.
+ */
+void flashLogRewind(void);
+
+/** Gets a snapshot of the flash log statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void flashLogGetStats(flashLogStats_t *pStats);
+
+
+#endif // FLASH_LOG_H__
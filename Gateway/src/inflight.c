@@ -0,0 +1,314 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in inflight.h
+ */
+
+#include "inflight.h"
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <string.h>
+#include <errno.h>
+
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** How often (msec) the link is polled while it is down */
+#define INFLIGHT_LINK_POLL_MS   200
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** A batch in the window */
+typedef struct{
+    char message[CONFIG_AQM_BATCH_MAX_BYTES];
+    size_t len;
+    uint32_t samples;       /**< Samples (or rollups) in the batch */
+    uint32_t logSeq;        /**< Last replayed sample (flash log), zero if none */
+    uint32_t logGen;        /**< Flash log replay it was read in, see gLogGen */
+    aqmSample_t live[CONFIG_AQM_BATCH_MAX_SAMPLES]; /**< The samples not in the flash log */
+    uint32_t liveCount;
+    uint16_t packetId;      /**< Assigned by the Gateway, never zero */
+}inflightSlot_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gInflightStack, CONFIG_AQM_INFLIGHT_THREAD_STACK_SIZE);
+static struct k_thread gInflightThread;
+
+/** The window: a ring of slots. gTail is only used by the thread calling
+ * inflightPut(), gHead by the publishing thread */
+static inflightSlot_t gSlot[CONFIG_AQM_INFLIGHT_WINDOW];
+static uint32_t gHead;
+static uint32_t gTail;
+static uint16_t gNextPacketId = 1;
+
+/** Free slots, and batches waiting to be published */
+static K_SEM_DEFINE(gFree, CONFIG_AQM_INFLIGHT_WINDOW, CONFIG_AQM_INFLIGHT_WINDOW);
+static K_SEM_DEFINE(gQueued, 0, CONFIG_AQM_INFLIGHT_WINDOW);
+
+static atomic_t gDoneLogSeq = ATOMIC_INIT(0);
+
+/** Replay of the flash log, incremented every time it is read again from
+ * its cursor: only the batches of the current replay move gDoneLogSeq */
+static atomic_t gLogGen = ATOMIC_INIT(0);
+
+/** A batch with replayed samples was dropped: gDoneLogSeq stays where it
+ * is until the flash log is read again from its cursor */
+static atomic_t gLogRewind = ATOMIC_INIT(0);
+
+/** The batch at gHead was dropped and its samples not in the flash log
+ * wait to be taken back, the thread waits on gLiveTaken meanwhile */
+static atomic_t gLiveDropped = ATOMIC_INIT(0);
+static K_SEM_DEFINE(gLiveTaken, 0, 1);
+
+static atomic_t gDepth = ATOMIC_INIT(0);
+static atomic_t gMaxDepth = ATOMIC_INIT(0);
+static atomic_t gAcked = ATOMIC_INIT(0);
+static atomic_t gSamplesAcked = ATOMIC_INIT(0);
+static atomic_t gRetransmits = ATOMIC_INIT(0);
+static atomic_t gDropped = ATOMIC_INIT(0);
+static atomic_t gSamplesDropped = ATOMIC_INIT(0);
+static atomic_t gAckMsTotal = ATOMIC_INIT(0);
+static atomic_t gAckMsMax = ATOMIC_INIT(0);
+static atomic_t gFirstAckMs = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Publishes a batch until it is acknowledged or too many publishes failed.
+ * Returns the time (msec) from the first publish to the acknowledgement, or
+ * negative if dropped */
+static int32_t inflightSend(const inflightSlot_t *pSlot)
+{
+    uint32_t firstMs = 0;
+    uint32_t retries = 0;
+
+    for( ;; ){
+        // the batch stays in the window while the link is down
+        while( !linkIsUp() ){
+            k_sleep(K_MSEC(INFLIGHT_LINK_POLL_MS));
+        }
+
+        if( retries == 0 ){
+            firstMs = k_uptime_get_32();
+        }
+
+        // returns once the broker has acknowledged it (PUBACK)
+        if( linkPublishTopic(LINK_TOPIC_MEASUREMENTS, pSlot->message, pSlot->len, true) == 0 ){
+            return (int32_t)(k_uptime_get_32() - firstMs);
+        }
+
+        // the broker may be gone without a disconnect callback: then the
+        // batch waits for the link, without using up its retries
+        linkCheck();
+        if( !linkIsUp() ){
+            continue;
+        }
+
+        if( retries >= CONFIG_AQM_INFLIGHT_MAX_RETRIES ){
+            return -ETIMEDOUT;
+        }
+        retries++;
+        atomic_inc(&gRetransmits);
+        printk("Message %u not acknowledged, retry %u\r\n", pSlot->packetId, retries);
+
+        k_sleep(K_MSEC(CONFIG_AQM_INFLIGHT_RETRY_MS));
+    }
+}
+
+
+static void inflightThread(void *p1, void *p2, void *p3)
+{
+    for( ;; ){
+        inflightSlot_t *pSlot;
+        int32_t ackMs;
+
+        k_sem_take(&gQueued, K_FOREVER);
+        pSlot = &gSlot[gHead];
+
+        ackMs = inflightSend(pSlot);
+        if( ackMs >= 0 ){
+            atomic_cas(&gFirstAckMs, 0, (atomic_val_t)k_uptime_get_32());
+            atomic_inc(&gAcked);
+            atomic_add(&gSamplesAcked, (atomic_val_t)pSlot->samples);
+            atomic_add(&gAckMsTotal, (atomic_val_t)ackMs);
+            if( ackMs > atomic_get(&gAckMsMax) ){
+                atomic_set(&gAckMsMax, (atomic_val_t)ackMs);
+            }
+            printk("Message %u acknowledged (%u samples, %d ms)\r\n",
+                   pSlot->packetId, pSlot->samples, ackMs);
+
+            // the batches of an older replay were read before the one
+            // dropped was: the flash log cursor only moves for the current one
+            if( ( pSlot->logSeq != 0 ) && !atomic_get(&gLogRewind) &&
+                ( pSlot->logGen == (uint32_t)atomic_get(&gLogGen) ) ){
+                atomic_set(&gDoneLogSeq, (atomic_val_t)pSlot->logSeq);
+            }
+        }
+        else{
+            atomic_inc(&gDropped);
+            atomic_add(&gSamplesDropped, (atomic_val_t)pSlot->samples);
+            printk("Message %u dropped (%u samples)\r\n", pSlot->packetId, pSlot->samples);
+
+            // the replayed samples are still in the flash log, read again
+            if( pSlot->logSeq != 0 ){
+                atomic_set(&gLogRewind, 1);
+            }
+
+            // the others are handed back to be stored again, the slot is
+            // kept until they are copied
+            if( pSlot->liveCount > 0 ){
+                atomic_set(&gLiveDropped, 1);
+                k_sem_take(&gLiveTaken, K_FOREVER);
+            }
+        }
+
+        gHead = (gHead + 1) % CONFIG_AQM_INFLIGHT_WINDOW;
+        atomic_dec(&gDepth);
+        k_sem_give(&gFree);
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void inflightStart(void)
+{
+    k_thread_create(&gInflightThread, gInflightStack,
+                    K_THREAD_STACK_SIZEOF(gInflightStack),
+                    inflightThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY), 0, K_NO_WAIT);
+    k_thread_name_set(&gInflightThread, "inflight");
+}
+
+
+int inflightPut(const char *pMessage, size_t len, uint32_t samples, uint32_t logSeq,
+                const aqmSample_t *pLive, uint32_t liveCount, k_timeout_t timeout)
+{
+    inflightSlot_t *pSlot;
+    atomic_val_t depth;
+
+    if( ( len > sizeof(pSlot->message) ) || ( liveCount > CONFIG_AQM_BATCH_MAX_SAMPLES ) ){
+        return -EMSGSIZE;
+    }
+
+    if( k_sem_take(&gFree, timeout) != 0 ){
+        return -EAGAIN;
+    }
+
+    pSlot = &gSlot[gTail];
+    memcpy(pSlot->message, pMessage, len);
+    pSlot->len = len;
+    pSlot->samples = samples;
+    pSlot->logSeq = logSeq;
+    pSlot->logGen = (uint32_t)atomic_get(&gLogGen);
+    memcpy(pSlot->live, pLive, liveCount * sizeof(aqmSample_t));
+    pSlot->liveCount = liveCount;
+    pSlot->packetId = gNextPacketId;
+
+    gNextPacketId++;
+    if( gNextPacketId == 0 ){
+        gNextPacketId = 1;
+    }
+    gTail = (gTail + 1) % CONFIG_AQM_INFLIGHT_WINDOW;
+
+    // atomic_inc returns the previous value
+    depth = atomic_inc(&gDepth) + 1;
+    if( depth > atomic_get(&gMaxDepth) ){
+        atomic_set(&gMaxDepth, depth);
+    }
+
+    k_sem_give(&gQueued);
+
+    return 0;
+}
+
+
+uint32_t inflightDoneLogSeq(void)
+{
+    return (uint32_t)atomic_get(&gDoneLogSeq);
+}
+
+
+bool inflightLogRewind(void)
+{
+    if( !atomic_get(&gLogRewind) ){
+        return false;
+    }
+
+    // new replay first, so the batches of the older one no longer count
+    atomic_inc(&gLogGen);
+    atomic_set(&gLogRewind, 0);
+
+    return true;
+}
+
+
+uint32_t inflightTakeDropped(aqmSample_t *pSamples)
+{
+    const inflightSlot_t *pSlot;
+    uint32_t count;
+
+    if( !atomic_get(&gLiveDropped) ){
+        return 0;
+    }
+
+    // the thread waits on gLiveTaken: gHead and the slot stay as they are
+    pSlot = &gSlot[gHead];
+    count = pSlot->liveCount;
+    memcpy(pSamples, pSlot->live, count * sizeof(aqmSample_t));
+
+    atomic_set(&gLiveDropped, 0);
+    k_sem_give(&gLiveTaken);
+
+    return count;
+}
+
+
+void inflightGetStats(inflightStats_t *pStats)
+{
+    pStats->depth = (uint32_t)atomic_get(&gDepth);
+    pStats->maxDepth = (uint32_t)atomic_get(&gMaxDepth);
+    pStats->acked = (uint32_t)atomic_get(&gAcked);
+    pStats->samplesAcked = (uint32_t)atomic_get(&gSamplesAcked);
+    pStats->retransmits = (uint32_t)atomic_get(&gRetransmits);
+    pStats->dropped = (uint32_t)atomic_get(&gDropped);
+    pStats->samplesDropped = (uint32_t)atomic_get(&gSamplesDropped);
+    pStats->ackMsTotal = (uint32_t)atomic_get(&gAckMsTotal);
+    pStats->ackMsMax = (uint32_t)atomic_get(&gAckMsMax);
+    pStats->firstAckMs = (uint32_t)atomic_get(&gFirstAckMs);
+}
+
+#endif // CONFIG_AQM_UPLINK_QOS1
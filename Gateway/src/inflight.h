@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INFLIGHT_H__
+#define  INFLIGHT_H__
+
+/** @file
+ * @brief The in-flight window publishes the batches with QoS 1
+ * (CONFIG_AQM_UPLINK_QOS1) from its own thread, so the uplink thread does not
+ * wait for the broker acknowledgement of every batch: it hands the batch over
+ * and goes on with the next one while up to CONFIG_AQM_INFLIGHT_WINDOW
+ * batches are still unacknowledged.
+ *
+ * The window keeps a copy of every batch, with a packet id assigned by the
+ * Gateway, until the QoS 1 publish of ubxlib reports it acknowledged. A
+ * publish which fails (or times out) is sent again after
+ * CONFIG_AQM_INFLIGHT_RETRY_MS, up to CONFIG_AQM_INFLIGHT_MAX_RETRIES times.
+ * While the link is down the batches stay in the window and are sent once
+ * it is up again. The batches are acknowledged in order.
+ *
+ * A dropped batch with samples replayed from the flash log (see
+ * flash_log.h) does not move the flash log cursor: the log is read again
+ * from its cursor (see inflightLogRewind()), the batches of the earlier
+ * replay still in the window no longer move it either. The window also
+ * keeps a copy of the other samples of the batch (received live or taken
+ * from the store ring): when the batch is dropped they are handed back
+ * (see inflightTakeDropped()) to be stored again.
+ */
+
+#include <zephyr.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the in-flight window */
+typedef struct{
+    uint32_t depth;         /**< Batches in the window now (not acknowledged yet) */
+    uint32_t maxDepth;      /**< Highest depth seen */
+    uint32_t acked;         /**< Batches acknowledged */
+    uint32_t samplesAcked;  /**< Samples in the batches acknowledged */
+    uint32_t retransmits;   /**< Publishes sent again */
+    uint32_t dropped;       /**< Batches dropped after too many retransmits */
+    uint32_t samplesDropped;/**< Samples in the batches dropped (stored again, or read again from the flash log) */
+    uint32_t ackMsTotal;    /**< Total first publish to acknowledgement time (msec) */
+    uint32_t ackMsMax;      /**< Longest first publish to acknowledgement time (msec) */
+    uint32_t firstAckMs;    /**< Uptime (msec) of the first acknowledgement, zero if not yet */
+}inflightStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the thread publishing the batches of the window. The link (see
+ *  link.h) should be initialized.
+ */
+void inflightStart(void);
+
+/** Copies a batch into the window, to be published with QoS 1.
+ *
+ * @param pMessage  The encoded batch.
+ * @param len       Length of the batch.
+ * @param samples   Number of samples (or rollups) in the batch.
+ * @param logSeq    Sequence number (flash log) of the last replayed sample
+ *                  in the batch, zero if none.
+ * @param pLive     The samples of the batch which are not in the flash
+ *                  log, handed back if the batch is dropped.
+ * @param liveCount Number of samples in pLive (at most
+ *                  CONFIG_AQM_BATCH_MAX_SAMPLES).
+ * @param timeout   How long to wait for room in the window.
+ * @return          zero on success, -EAGAIN if the window stayed full or
+ *                  -EMSGSIZE if the batch is too long.
+ */
+int inflightPut(const char *pMessage, size_t len, uint32_t samples, uint32_t logSeq,
+                const aqmSample_t *pLive, uint32_t liveCount, k_timeout_t timeout);
+
+/** Gets the sequence number (flash log) of the last replayed sample
+ *  acknowledged. The batches are acknowledged in order, so all the replayed
+ *  samples up to it are done with.
+ *
+ * @return  the sequence number, zero if none yet.
+ */
+uint32_t inflightDoneLogSeq(void);
+
+/** Checks if a batch with replayed samples was dropped since the last call.
+ *  The flash log should then be read again from its cursor, before the
+ *  next batch is put in the window. Only called by the thread calling
+ *  inflightPut().
+ *
+ * @return  true if the flash log should be read again.
+ */
+bool inflightLogRewind(void);
+
+/** Takes back the samples (not in the flash log) of a batch dropped, to be
+ *  stored again. The window does not publish the next batch until they are
+ *  taken, so the thread calling inflightPut() should also call it while it
+ *  waits for room in the window.
+ *
+ * @param pSamples  Where the samples are copied, room for
+ *                  CONFIG_AQM_BATCH_MAX_SAMPLES samples.
+ * @return          the number of samples copied, zero if none.
+ */
+uint32_t inflightTakeDropped(aqmSample_t *pSamples);
+
+/** Gets a snapshot of the in-flight window statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void inflightGetStats(inflightStats_t *pStats);
+
+
+#endif // INFLIGHT_H__
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in ingest_queue.h
+ */
+
+#include "ingest_queue.h"
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** The queue itself. Zephyr message queues copy the samples, so the scan
+ * callback can reuse its local sample right after the put */
+K_MSGQ_DEFINE(gIngestMsgq, sizeof(aqmSample_t), CONFIG_AQM_INGEST_QUEUE_LEN, 4);
+
+/** Counters, written by the producer and read by anyone asking for stats */
+static atomic_t gEnqueued = ATOMIC_INIT(0);
+static atomic_t gDropped = ATOMIC_INIT(0);
+static atomic_t gMaxDepth = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+bool ingestQueuePut(const aqmSample_t *pSample)
+{
+    if( k_msgq_put(&gIngestMsgq, pSample, K_NO_WAIT) != 0 ){
+        atomic_inc(&gDropped);
+        return false;
+    }
+
+    atomic_inc(&gEnqueued);
+
+    // there is only one producer, so a plain compare is enough here
+    atomic_val_t depth = (atomic_val_t)k_msgq_num_used_get(&gIngestMsgq);
+    if( depth > atomic_get(&gMaxDepth) ){
+        atomic_set(&gMaxDepth, depth);
+    }
+
+    return true;
+}
+
+
+int ingestQueueGet(aqmSample_t *pSample, k_timeout_t timeout)
+{
+    return k_msgq_get(&gIngestMsgq, pSample, timeout);
+}
+
+
+void ingestQueueGetStats(ingestQueueStats_t *pStats)
+{
+    pStats->enqueued = (uint32_t)atomic_get(&gEnqueued);
+    pStats->dropped = (uint32_t)atomic_get(&gDropped);
+    pStats->depth = k_msgq_num_used_get(&gIngestMsgq);
+    pStats->maxDepth = (uint32_t)atomic_get(&gMaxDepth);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INGEST_QUEUE_H__
+#define  INGEST_QUEUE_H__
+
+/** @file
+ * @brief The ingest queue carries decoded samples from the Bluetooth scan
+ * callback (BT RX thread) to the uplink thread. The producer never blocks:
+ * when the queue is full the sample is dropped and counted.
+ */
+
+#include <zephyr.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the ingest queue */
+typedef struct{
+    uint32_t enqueued;     /**< Samples successfully put in the queue */
+    uint32_t dropped;      /**< Samples dropped because the queue was full */
+    uint32_t depth;        /**< Samples currently waiting in the queue */
+    uint32_t maxDepth;     /**< Highest depth observed since boot */
+}ingestQueueStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Puts a sample in the queue without blocking. Safe to call from the
+ *  Bluetooth scan callback.
+ *
+ * @param pSample  The sample to be copied in the queue.
+ * @return         true if the sample was queued, false if it was dropped.
+ */
+bool ingestQueuePut(const aqmSample_t *pSample);
+
+/** Gets the oldest sample from the queue.
+ *
+ * @param pSample  Where the sample is copied.
+ * @param timeout  How long to wait for a sample.
+ * @return         zero on success else negative error code (-EAGAIN on timeout).
+ */
+int ingestQueueGet(aqmSample_t *pSample, k_timeout_t timeout);
+
+/** Gets a snapshot of the queue statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void ingestQueueGetStats(ingestQueueStats_t *pStats);
+
+
+#endif // INGEST_QUEUE_H__
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in json_fixed.h
+ */
+
+#include "json_fixed.h"
+
+#include <string.h>
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** 10^n, for the supported numbers of decimals */
+static const uint32_t gPow10[JSON_FIXED_MAX_DECIMALS + 1] = { 1, 10, 100, 1000, 10000 };
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Copies a string without its terminator, returns its length */
+static size_t jsonFixedPutStr(char *pBuf, const char *pStr)
+{
+    size_t len = strlen(pStr);
+
+    memcpy(pBuf, pStr, len);
+
+    return len;
+}
+
+
+/** Writes JSON_FIXED_ROLLUP_STATS values as an array, returns its length */
+static size_t jsonFixedPutStats(char *pBuf, const float *pValues, uint8_t decimals)
+{
+    size_t len = 0;
+
+    pBuf[len++] = '[';
+    for( int i = 0; i < JSON_FIXED_ROLLUP_STATS; i++ ){
+        if( i > 0 ){
+            pBuf[len++] = ',';
+        }
+        len += jsonFixedPutFixed(&pBuf[len], pValues[i], decimals);
+    }
+    pBuf[len++] = ']';
+
+    return len;
+}
+
+
+/** Writes the time member ,"t":<timeMs> if the time is known, returns its
+ * length */
+static size_t jsonFixedPutTime(char *pBuf, uint64_t timeMs)
+{
+    char digits[JSON_FIXED_TIME_MAX_LEN];
+    size_t count = 0;
+    size_t len;
+
+    if( timeMs == 0 ){
+        return 0;
+    }
+
+    len = jsonFixedPutStr(pBuf, ",\"t\":");
+
+    // digits come out least significant first
+    do{
+        digits[count++] = (char)( '0' + ( timeMs % 10 ) );
+        timeMs /= 10;
+    }while( timeMs > 0 );
+
+    while( count > 0 ){
+        pBuf[len++] = digits[--count];
+    }
+
+    return len;
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+size_t jsonFixedPutUint(char *pBuf, uint32_t value)
+{
+    char digits[10];
+    size_t count = 0;
+    size_t len;
+
+    // digits come out least significant first
+    do{
+        digits[count++] = (char)( '0' + ( value % 10 ) );
+        value /= 10;
+    }while( value > 0 );
+
+    for( len = 0; len < count; len++ ){
+        pBuf[len] = digits[count - 1 - len];
+    }
+
+    return len;
+}
+
+
+size_t jsonFixedPutFixed(char *pBuf, float value, uint8_t decimals)
+{
+    uint32_t scale;
+    uint32_t scaled;
+    float absScaled;
+    size_t len = 0;
+
+    if( decimals > JSON_FIXED_MAX_DECIMALS ){
+        decimals = JSON_FIXED_MAX_DECIMALS;
+    }
+    scale = gPow10[decimals];
+
+    // NaN is not valid JSON, write it as 0
+    if( value != value ){
+        value = 0.0f;
+    }
+
+    // scale and round the magnitude to the nearest, clamped to the integer range
+    absScaled = ( ( value < 0.0f ) ? -value : value ) * (float)scale + 0.5f;
+    scaled = ( absScaled >= 4294967040.0f ) ? UINT32_MAX : (uint32_t)absScaled;
+
+    // no sign for values which round to zero
+    if( ( value < 0.0f ) && ( scaled > 0 ) ){
+        pBuf[len++] = '-';
+    }
+
+    len += jsonFixedPutUint(&pBuf[len], scaled / scale);
+
+    if( decimals > 0 ){
+        uint32_t fraction = scaled % scale;
+
+        pBuf[len++] = '.';
+        // leading zeros of the fraction
+        for( uint32_t div = scale / 10; div > 0; div /= 10 ){
+            pBuf[len++] = (char)( '0' + ( fraction / div ) % 10 );
+        }
+    }
+
+    return len;
+}
+
+
+int jsonFixedWriteSample(char *pBuf, size_t size, const char *pDevStr, uint32_t id,
+                         float co2, float humidity, float temperature, uint64_t timeMs,
+                         const jsonFixedDecimals_t *pDecimals)
+{
+    size_t len = 0;
+
+    // check once for the longest sample, then write without checks
+    if( size < JSON_FIXED_SAMPLE_MAX_LEN(strlen(pDevStr)) ){
+        return -1;
+    }
+
+    len += jsonFixedPutStr(&pBuf[len], "{\"dev\":\"");
+    len += jsonFixedPutStr(&pBuf[len], pDevStr);
+    len += jsonFixedPutStr(&pBuf[len], "\",\"id\":");
+    len += jsonFixedPutUint(&pBuf[len], id);
+    len += jsonFixedPutStr(&pBuf[len], ",\"c02level\":");
+    len += jsonFixedPutFixed(&pBuf[len], co2, pDecimals->co2);
+    len += jsonFixedPutStr(&pBuf[len], ",\"humidity\":");
+    len += jsonFixedPutFixed(&pBuf[len], humidity, pDecimals->humidity);
+    len += jsonFixedPutStr(&pBuf[len], ",\"temperature\":");
+    len += jsonFixedPutFixed(&pBuf[len], temperature, pDecimals->temperature);
+    len += jsonFixedPutTime(&pBuf[len], timeMs);
+    pBuf[len++] = '}';
+
+    return (int)len;
+}
+
+
+int jsonFixedWriteRollup(char *pBuf, size_t size, const char *pDevStr,
+                         uint32_t windowS, uint32_t count, uint32_t id,
+                         const float *pCo2, const float *pHumidity, const float *pTemperature,
+                         uint64_t timeMs, const jsonFixedDecimals_t *pDecimals)
+{
+    size_t len = 0;
+
+    // check once for the longest rollup, then write without checks
+    if( size < JSON_FIXED_ROLLUP_MAX_LEN(strlen(pDevStr)) ){
+        return -1;
+    }
+
+    len += jsonFixedPutStr(&pBuf[len], "{\"dev\":\"");
+    len += jsonFixedPutStr(&pBuf[len], pDevStr);
+    len += jsonFixedPutStr(&pBuf[len], "\",\"win\":");
+    len += jsonFixedPutUint(&pBuf[len], windowS);
+    len += jsonFixedPutStr(&pBuf[len], ",\"n\":");
+    len += jsonFixedPutUint(&pBuf[len], count);
+    len += jsonFixedPutStr(&pBuf[len], ",\"id\":");
+    len += jsonFixedPutUint(&pBuf[len], id);
+    len += jsonFixedPutStr(&pBuf[len], ",\"c02level\":");
+    len += jsonFixedPutStats(&pBuf[len], pCo2, pDecimals->co2);
+    len += jsonFixedPutStr(&pBuf[len], ",\"humidity\":");
+    len += jsonFixedPutStats(&pBuf[len], pHumidity, pDecimals->humidity);
+    len += jsonFixedPutStr(&pBuf[len], ",\"temperature\":");
+    len += jsonFixedPutStats(&pBuf[len], pTemperature, pDecimals->temperature);
+    len += jsonFixedPutTime(&pBuf[len], timeMs);
+    pBuf[len++] = '}';
+
+    return (int)len;
+}
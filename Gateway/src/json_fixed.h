@@ -0,0 +1,148 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_FIXED_H__
+#define  JSON_FIXED_H__
+
+/** @file
+ * @brief A small JSON serializer for the measurements, which writes the
+ * values in fixed-point (a scaled integer printed with a fixed number of
+ * decimals) straight into a caller-provided buffer. It does not allocate,
+ * does not use printf and does not need the floating point support of
+ * cbprintf (CONFIG_CBPRINTF_FP_SUPPORT).
+ *
+ * It does not depend on Zephyr, so it can also be built on the host (see
+ * the benchmark in the bench folder).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Maximum number of decimals of a fixed-point value */
+#define JSON_FIXED_MAX_DECIMALS     4
+
+/** Maximum length of a fixed-point value: sign, 10 digits and the point */
+#define JSON_FIXED_VALUE_MAX_LEN    12
+
+/** Maximum length of a time (msec since the Unix epoch) */
+#define JSON_FIXED_TIME_MAX_LEN     20
+
+/** Maximum length of a sample written by jsonFixedWriteSample(), for a device
+ * string of devStrLen characters */
+#define JSON_FIXED_SAMPLE_MAX_LEN(devStrLen) \
+    ( sizeof("{\"dev\":\"\",\"id\":,\"c02level\":,\"humidity\":,\"temperature\":,\"t\":}") - 1 + \
+      (devStrLen) + 10 + 3 * JSON_FIXED_VALUE_MAX_LEN + JSON_FIXED_TIME_MAX_LEN )
+
+/** Number of statistics of every value of a rollup: min, max, mean, last */
+#define JSON_FIXED_ROLLUP_STATS     4
+
+/** Maximum length of a rollup written by jsonFixedWriteRollup(), for a device
+ * string of devStrLen characters */
+#define JSON_FIXED_ROLLUP_MAX_LEN(devStrLen) \
+    ( sizeof("{\"dev\":\"\",\"win\":,\"n\":,\"id\":,\"c02level\":[,,,],\"humidity\":[,,,],\"temperature\":[,,,],\"t\":}") - 1 + \
+      (devStrLen) + 3 * 10 + 3 * JSON_FIXED_ROLLUP_STATS * JSON_FIXED_VALUE_MAX_LEN + \
+      JSON_FIXED_TIME_MAX_LEN )
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Number of decimals of the fixed-point values of a sample */
+typedef struct{
+    uint8_t co2;            /**< Decimals of the CO2 level, usually 0 (ppm) */
+    uint8_t humidity;       /**< Decimals of the relative humidity */
+    uint8_t temperature;    /**< Decimals of the temperature */
+}jsonFixedDecimals_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Writes an unsigned integer.
+ *
+ * @param pBuf   Where to write, at least 10 bytes.
+ * @param value  The value.
+ * @return       the number of characters written.
+ */
+size_t jsonFixedPutUint(char *pBuf, uint32_t value);
+
+/** Writes a value in fixed-point: rounded to the number of decimals given.
+ *  Values out of the range of the scaled integer are clamped.
+ *
+ * @param pBuf      Where to write, at least JSON_FIXED_VALUE_MAX_LEN bytes.
+ * @param value     The value.
+ * @param decimals  Number of decimals (up to JSON_FIXED_MAX_DECIMALS).
+ * @return          the number of characters written.
+ */
+size_t jsonFixedPutFixed(char *pBuf, float value, uint8_t decimals);
+
+/** Writes a sample as a JSON object (not null terminated):
+ *  {"dev":"<pDevStr>","id":<id>,"c02level":<co2>,"humidity":<humidity>,"temperature":<temperature>,"t":<timeMs>}
+ *  where "t" is left out if the time is not known.
+ *
+ * @param pBuf         Where to write.
+ * @param size         Size of pBuf.
+ * @param pDevStr      The device string (no characters to escape).
+ * @param id           The message id.
+ * @param co2          The CO2 level.
+ * @param humidity     The relative humidity.
+ * @param temperature  The temperature.
+ * @param timeMs       Time of the sample (msec since the Unix epoch), zero
+ *                     if not known.
+ * @param pDecimals    Decimals of the values.
+ * @return             the number of characters written, or negative if the
+ *                     sample may not fit in size bytes.
+ */
+int jsonFixedWriteSample(char *pBuf, size_t size, const char *pDevStr, uint32_t id,
+                         float co2, float humidity, float temperature, uint64_t timeMs,
+                         const jsonFixedDecimals_t *pDecimals);
+
+/** Writes a rollup (statistics of the samples of a device over a window) as
+ *  a JSON object (not null terminated), every value as an array of
+ *  JSON_FIXED_ROLLUP_STATS statistics [min,max,mean,last]:
+ *  {"dev":"<pDevStr>","win":<windowS>,"n":<count>,"id":<id>,
+ *   "c02level":[...],"humidity":[...],"temperature":[...],"t":<timeMs>}
+ *  where "t" is left out if the time is not known.
+ *
+ * @param pBuf          Where to write.
+ * @param size          Size of pBuf.
+ * @param pDevStr       The device string (no characters to escape).
+ * @param windowS       Length of the window (seconds).
+ * @param count         Number of samples in the window.
+ * @param id            The message id of the last sample.
+ * @param pCo2          The statistics of the CO2 level.
+ * @param pHumidity     The statistics of the relative humidity.
+ * @param pTemperature  The statistics of the temperature.
+ * @param timeMs        Time of the last sample (msec since the Unix epoch),
+ *                      zero if not known.
+ * @param pDecimals     Decimals of the values.
+ * @return              the number of characters written, or negative if the
+ *                      rollup may not fit in size bytes.
+ */
+int jsonFixedWriteRollup(char *pBuf, size_t size, const char *pDevStr,
+                         uint32_t windowS, uint32_t count, uint32_t id,
+                         const float *pCo2, const float *pHumidity, const float *pTemperature,
+                         uint64_t timeMs, const jsonFixedDecimals_t *pDecimals);
+
+
+#endif // JSON_FIXED_H__
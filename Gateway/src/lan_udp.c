@@ -0,0 +1,186 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in lan_udp.h
+ */
+
+#include "lan_udp.h"
+
+#if defined(CONFIG_AQM_LAN_UDP)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <errno.h>
+
+#include "ubxlib.h"
+#include "batch.h"
+#include "device_table.h"
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Maximum length of a datagram (a single sample) */
+#define LAN_UDP_MAX_LEN         192
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gLanUdpStack, CONFIG_AQM_LAN_UDP_THREAD_STACK_SIZE);
+static struct k_thread gLanUdpThread;
+
+K_MSGQ_DEFINE(gLanUdpMsgq, sizeof(aqmSample_t), CONFIG_AQM_LAN_UDP_QUEUE_LEN, 4);
+
+/** Destination of the datagrams, parsed once at start */
+static uSockAddress_t gAddress;
+
+/** The socket, negative while not open. Only used under the link lock */
+static int32_t gSock = -1;
+
+static atomic_t gSent = ATOMIC_INIT(0);
+static atomic_t gFailed = ATOMIC_INIT(0);
+static atomic_t gDropped = ATOMIC_INIT(0);
+static atomic_t gLatencyMsMax = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Closes the socket, called by the link (locked) before it is lost */
+static void lanUdpClose(void)
+{
+    if( gSock >= 0 ){
+        uSockClose(gSock);
+        gSock = -1;
+    }
+}
+
+
+/** Sends a sample in a datagram, opening the socket first if needed */
+static int lanUdpSend(const aqmSample_t *pSample)
+{
+    static char message[LAN_UDP_MAX_LEN];
+    uDeviceHandle_t devHandle;
+    int err = 0;
+    int32_t len;
+
+    len = batchEncodeSingle(pSample, &deviceTableGet(pSample->deviceIndex)->addr,
+                            message, sizeof(message));
+    if( len < 0 ){
+        return (int)len;
+    }
+
+    devHandle = linkSocketLock();
+    if( devHandle == NULL ){
+        return -ENOTCONN;
+    }
+
+    if( gSock < 0 ){
+        gSock = uSockCreate(devHandle, U_SOCK_TYPE_DGRAM, U_SOCK_PROTOCOL_UDP);
+        if( gSock < 0 ){
+            err = (int)gSock;
+        }
+    }
+
+    if( ( err == 0 ) && ( uSockSendTo(gSock, &gAddress, message, len) != len ) ){
+        // opened again for the next datagram
+        lanUdpClose();
+        err = -EIO;
+    }
+
+    linkSocketUnlock();
+
+    return err;
+}
+
+
+static void lanUdpThread(void *p1, void *p2, void *p3)
+{
+    aqmSample_t sample;
+
+    for( ;; ){
+        uint32_t latencyMs;
+        int err;
+
+        k_msgq_get(&gLanUdpMsgq, &sample, K_FOREVER);
+
+        if( !linkIsWifiUp() ){
+            atomic_inc(&gDropped);
+            continue;
+        }
+
+        err = lanUdpSend(&sample);
+        if( err ){
+            atomic_inc(&gFailed);
+            printk("LAN datagram could not be sent (err %d)\r\n", err);
+            continue;
+        }
+
+        latencyMs = k_uptime_get_32() - sample.rxTimeMs;
+        if( latencyMs > (uint32_t)atomic_get(&gLatencyMsMax) ){
+            atomic_set(&gLatencyMsMax, (atomic_val_t)latencyMs);
+        }
+        atomic_inc(&gSent);
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void lanUdpStart(void)
+{
+    if( uSockStringToAddress(CONFIG_AQM_LAN_UDP_ADDRESS, &gAddress) != 0 ){
+        printk("Invalid LAN address %s, LAN output disabled\r\n", CONFIG_AQM_LAN_UDP_ADDRESS);
+        return;
+    }
+
+    linkAddSocketCloseCallback(lanUdpClose);
+
+    // below the uplink: the cloud path never waits for the LAN one
+    k_thread_create(&gLanUdpThread, gLanUdpStack,
+                    K_THREAD_STACK_SIZEOF(gLanUdpStack),
+                    lanUdpThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY + 1), 0, K_NO_WAIT);
+    k_thread_name_set(&gLanUdpThread, "lan_udp");
+}
+
+
+void lanUdpPut(const aqmSample_t *pSample)
+{
+    if( k_msgq_put(&gLanUdpMsgq, pSample, K_NO_WAIT) != 0 ){
+        atomic_inc(&gDropped);
+    }
+}
+
+
+void lanUdpGetStats(lanUdpStats_t *pStats)
+{
+    pStats->sent = (uint32_t)atomic_get(&gSent);
+    pStats->failed = (uint32_t)atomic_get(&gFailed);
+    pStats->dropped = (uint32_t)atomic_get(&gDropped);
+    pStats->latencyMsMax = (uint32_t)atomic_get(&gLatencyMsMax);
+}
+
+#endif // CONFIG_AQM_LAN_UDP
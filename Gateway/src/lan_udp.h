@@ -0,0 +1,77 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LAN_UDP_H__
+#define  LAN_UDP_H__
+
+/** @file
+ * @brief The LAN output sends every new measurement, as soon as it is
+ * received, in a UDP datagram of its own to a multicast or unicast address
+ * of the local network (CONFIG_AQM_LAN_UDP_ADDRESS), over a UDP socket of
+ * NINA-W156 (CONFIG_AQM_LAN_UDP). Local consumers get the measurements
+ * without the batching and the round-trip to the broker, and also while the
+ * broker cannot be reached.
+ *
+ * The datagram has the same format as a batch of one sample (see batch.h).
+ *
+ * The measurements are handed over to a queue of their own, sent from a
+ * thread of its own below the uplink: the uplink never waits for them. When
+ * the queue is full, or Wi-Fi is down, the measurement is dropped (it still
+ * takes the normal path).
+ */
+
+#include <stdint.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the LAN output */
+typedef struct{
+    uint32_t sent;          /**< Datagrams sent */
+    uint32_t failed;        /**< Datagrams which could not be sent (socket error) */
+    uint32_t dropped;       /**< Measurements dropped: queue full or Wi-Fi down */
+    uint32_t latencyMsMax;  /**< Longest time (msec) from reception to sent */
+}lanUdpStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the thread sending the datagrams. The link (see link.h) should be
+ *  initialized.
+ */
+void lanUdpStart(void);
+
+/** Queues a new measurement to be sent, without waiting. Called from the
+ *  scan callback.
+ *
+ * @param pSample  The sample.
+ */
+void lanUdpPut(const aqmSample_t *pSample);
+
+/** Gets a snapshot of the LAN output statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void lanUdpGetStats(lanUdpStats_t *pStats);
+
+
+#endif // LAN_UDP_H__
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in last_value.h
+ */
+
+#include "last_value.h"
+
+#if defined(CONFIG_AQM_LAST_VALUE)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+
+#include "batch.h"
+#include "device_table.h"
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Prefix of the topic of every broadcaster, followed by its address */
+#define LAST_VALUE_TOPIC_PREFIX     "airquality/dev/"
+
+#define LAST_VALUE_PERIOD_MS        (CONFIG_AQM_LAST_VALUE_PERIOD_S * 1000U)
+
+/** Maximum length of a last value message (a single sample) */
+#define LAST_VALUE_MAX_LEN          192
+
+/** Maximum number of publishes per call of lastValueService(), so that the
+ * batches are not held up when many broadcasters are pending */
+#define LAST_VALUE_MAX_PER_SERVICE  4
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** State of a broadcaster */
+typedef struct{
+    aqmSample_t sample;         /**< Latest measurement */
+    linkNamedTopic_t topic;     /**< Its topic, the name built at the first publish */
+    uint32_t publishedMs;       /**< Uptime (msec) of the last publish */
+    bool published;             /**< A last value was published */
+    bool pending;               /**< sample was not published yet */
+}deviceLastValue_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static deviceLastValue_t gLastValue[CONFIG_AQM_MAX_DEVICES];
+
+/** Where the next lastValueService() starts, so every broadcaster gets its turn */
+static int gNext;
+
+static atomic_t gPublished = ATOMIC_INIT(0);
+static atomic_t gReplaced = ATOMIC_INIT(0);
+static atomic_t gFailed = ATOMIC_INIT(0);
+static atomic_t gPending = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Builds the topic name of a broadcaster, its address most significant
+ * byte first (as in the messages) */
+static void lastValueBuildTopic(linkNamedTopic_t *pTopic, const bt_addr_le_t *pAddr)
+{
+    const uint8_t *pVal = pAddr->a.val;
+
+    snprintk(pTopic->name, sizeof(pTopic->name),
+             LAST_VALUE_TOPIC_PREFIX "%02x%02x%02x%02x%02x%02x",
+             pVal[5], pVal[4], pVal[3], pVal[2], pVal[1], pVal[0]);
+}
+
+
+/** Checks if the last value of a broadcaster should be published now */
+static bool lastValueIsDueAt(const deviceLastValue_t *pState, uint32_t nowMs)
+{
+    return pState->pending &&
+           ( !pState->published || ( nowMs - pState->publishedMs >= LAST_VALUE_PERIOD_MS ) );
+}
+
+
+/** Publishes the last value of a broadcaster, retained */
+static int lastValuePublish(deviceLastValue_t *pState)
+{
+    static char message[LAST_VALUE_MAX_LEN];
+    const bt_addr_le_t *pAddr = &deviceTableGet(pState->sample.deviceIndex)->addr;
+    int len;
+
+    if( pState->topic.name[0] == '\0' ){
+        lastValueBuildTopic(&pState->topic, pAddr);
+    }
+
+    len = batchEncodeSingle(&pState->sample, pAddr, message, sizeof(message));
+    if( len < 0 ){
+        return len;
+    }
+
+    return (int)linkPublishNamed(&pState->topic, message, len, true);
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void lastValueUpdate(const aqmSample_t *pSample)
+{
+    deviceLastValue_t *pState = &gLastValue[pSample->deviceIndex];
+
+    if( pState->pending ){
+        atomic_inc(&gReplaced);
+    }
+    else{
+        pState->pending = true;
+        atomic_inc(&gPending);
+    }
+
+    pState->sample = *pSample;
+}
+
+
+void lastValueService(uint32_t nowMs)
+{
+    int count = (int)deviceTableCount();
+    int start = gNext;
+    int published = 0;
+
+    for( int i = 0; ( i < count ) && ( published < LAST_VALUE_MAX_PER_SERVICE ); i++ ){
+        int index = ( start + i ) % count;
+        deviceLastValue_t *pState = &gLastValue[index];
+        int err;
+
+        if( !lastValueIsDueAt(pState, nowMs) ){
+            continue;
+        }
+
+        err = lastValuePublish(pState);
+        if( err ){
+            // kept pending, published again at the next call
+            atomic_inc(&gFailed);
+            printk("Last value of device %d could not be published (err %d)\r\n", index, err);
+            linkCheck();
+            return;
+        }
+
+        pState->pending = false;
+        pState->published = true;
+        pState->publishedMs = nowMs;
+        atomic_dec(&gPending);
+        atomic_inc(&gPublished);
+
+        published++;
+        gNext = ( index + 1 ) % count;
+    }
+}
+
+
+bool lastValueIsDue(uint32_t nowMs)
+{
+    int count = (int)deviceTableCount();
+
+    for( int i = 0; i < count; i++ ){
+        if( lastValueIsDueAt(&gLastValue[i], nowMs) ){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void lastValueGetStats(lastValueStats_t *pStats)
+{
+    pStats->published = (uint32_t)atomic_get(&gPublished);
+    pStats->replaced = (uint32_t)atomic_get(&gReplaced);
+    pStats->failed = (uint32_t)atomic_get(&gFailed);
+    pStats->pending = (uint32_t)atomic_get(&gPending);
+}
+
+#endif // CONFIG_AQM_LAST_VALUE
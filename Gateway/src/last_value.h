@@ -0,0 +1,85 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LAST_VALUE_H__
+#define  LAST_VALUE_H__
+
+/** @file
+ * @brief The last value publishes the latest measurement of every
+ * broadcaster as a retained message on a topic of its own,
+ * airquality/dev/<address> (CONFIG_AQM_LAST_VALUE), so a dashboard gets the
+ * current state of every broadcaster as soon as it subscribes. The history
+ * stays on the (not retained) measurements topic.
+ *
+ * Every broadcaster is published at most once every
+ * CONFIG_AQM_LAST_VALUE_PERIOD_S, with its latest measurement: the
+ * measurements in between only replace the pending one. The topic name of a
+ * broadcaster is built once, the first time it is published.
+ *
+ * Per-device state is kept in arrays indexed by the device table index.
+ * Only used by the uplink thread, the statistics can be read by any thread.
+ */
+
+#include <stdint.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the last values */
+typedef struct{
+    uint32_t published;     /**< Last values published */
+    uint32_t replaced;      /**< Measurements replaced by a newer one before being published */
+    uint32_t failed;        /**< Publishes which failed (published again later) */
+    uint32_t pending;       /**< Broadcasters with a last value not published yet */
+}lastValueStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Keeps a new measurement as the last value of its broadcaster.
+ *
+ * @param pSample  The sample.
+ */
+void lastValueUpdate(const aqmSample_t *pSample);
+
+/** Publishes the pending last values whose broadcaster was not published
+ *  for CONFIG_AQM_LAST_VALUE_PERIOD_S, a few at a time. The link should be up.
+ *
+ * @param nowMs  Current uptime (msec).
+ */
+void lastValueService(uint32_t nowMs);
+
+/** Checks if last values are waiting for lastValueService().
+ *
+ * @param nowMs  Current uptime (msec).
+ * @return       true if at least one should be published now.
+ */
+bool lastValueIsDue(uint32_t nowMs);
+
+/** Gets a snapshot of the last value statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void lastValueGetStats(lastValueStats_t *pStats);
+
+
+#endif // LAST_VALUE_H__
@@ -0,0 +1,841 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in link.h
+ */
+
+#include "link.h"
+
+#include <zephyr.h>
+#include <devicetree.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <errno.h>
+
+#include "nina_config.h"
+#include "uart_bench.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** How often (msec) the uplink thread looks again while the module is being
+ * brought up */
+#define LINK_BRINGUP_POLL_MS    200
+
+/** How often (msec) the uplink thread looks again once the link has stopped
+ * for good (MQTT-SN not supported) */
+#define LINK_STOPPED_POLL_MS    60000
+
+// Topic names where the received measurements and the alarms are going to
+// be published. Should be defined to Thingstream as well
+#define MQTT_TOPIC          "airquality"
+#define MQTT_ALARM_TOPIC    "airquality/alarm"
+#define MQTT_BENCH_TOPIC    "airquality/bench"
+#define MQTT_TELEMETRY_TOPIC "airquality/telemetry"
+
+/** Maximum number of modules with sockets on NINA-W156 */
+#define LINK_MAX_SOCKET_CLOSE_CBS   4
+
+/** Time (msec) given to NINA-W156 to apply a new UART rate after its OK */
+#define LINK_UART_SWITCH_MS     50
+
+// Above the boot rate, NINA-W156 needs RTS/CTS not to overrun either side
+BUILD_ASSERT(( CONFIG_AQM_NINA_BAUD_RATE <= 115200 ) ||
+             DT_PROP(DT_NODELABEL(uart2), hw_flow_control),
+             "CONFIG_AQM_NINA_BAUD_RATE needs hw-flow-control on uart2");
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gBringUpStack, CONFIG_AQM_BRINGUP_THREAD_STACK_SIZE);
+static struct k_thread gBringUpThread;
+
+/** The device configuration, with the UART rate in use */
+static uDeviceCfg_t gDeviceCfg;
+static uDeviceHandle_t gDevHandle;
+
+/** The UART rate NINA-W156 starts with */
+static int32_t gBootBaudRate;
+static const uNetworkCfgWifi_t *gpWifiCfg;
+static const uMqttClientConnection_t *gpMqttConnection;
+static uMqttClientContext_t *gpMqttClientCtx;
+
+/** Keeps a publish from another thread away from a reconnection, which may
+ * close the MQTT client */
+static K_MUTEX_DEFINE(gLock);
+
+/** Called, under the lock, before the sockets of NINA-W156 are lost. Set
+ * before the threads using sockets start */
+static void (*gSocketCloseCb[LINK_MAX_SOCKET_CLOSE_CBS])(void);
+static int gSocketCloseCbCount;
+
+/** Set by the ubxlib callbacks, so they are atomic */
+static atomic_t gWifiUp = ATOMIC_INIT(0);
+static atomic_t gMqttUp = ATOMIC_INIT(0);
+
+/** Reconnection state, only used by the thread calling linkService() */
+static uint32_t gBackoffMs = CONFIG_AQM_RECONNECT_MIN_MS;
+static uint32_t gNextAttemptMs;
+static bool gWifiEverUp;
+
+/** Uptime (msec) when the current outage started, if in an outage.
+ * Written by the thread calling linkService() only */
+static uint32_t gOutageStartMs;
+static bool gInOutage;
+
+/** Set by the bring-up thread once the module is open and the first
+ * connection was attempted: linkService() takes over from there */
+static atomic_t gReady = ATOMIC_INIT(0);
+
+/** Uptime (msec) of the bring-up milestones, zero until reached */
+static atomic_t gNinaReadyMs = ATOMIC_INIT(0);
+static atomic_t gFirstUpMs = ATOMIC_INIT(0);
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+/** Set when the module does not support MQTT-SN: no more attempts */
+static atomic_t gNotSupported = ATOMIC_INIT(0);
+
+/** Number of connections made (under the lock), the MQTT-SN topic ids of
+ * the named topics are only valid in the connection they were registered in */
+static uint32_t gConnection;
+#endif
+
+#if defined(CONFIG_AQM_POWER_GATING)
+/** Power gating state, only used by the thread calling linkService() */
+static uint32_t gSleepStartMs;
+static uint32_t gAwakeStartMs;
+static uint32_t gWakeMs;
+
+static atomic_t gAsleep = ATOMIC_INIT(0);
+static atomic_t gSleeps = ATOMIC_INIT(0);
+static atomic_t gWakes = ATOMIC_INIT(0);
+static atomic_t gWakeMsLast = ATOMIC_INIT(0);
+static atomic_t gWakeMsTotal = ATOMIC_INIT(0);
+static atomic_t gWakeMsMax = ATOMIC_INIT(0);
+static atomic_t gAwakeMs = ATOMIC_INIT(0);
+static atomic_t gAsleepMs = ATOMIC_INIT(0);
+#endif
+
+static atomic_t gOutages = ATOMIC_INIT(0);
+static atomic_t gAttempts = ATOMIC_INIT(0);
+static atomic_t gWifiReconnects = ATOMIC_INIT(0);
+static atomic_t gLastOutageMs = ATOMIC_INIT(0);
+static atomic_t gTotalOutageMs = ATOMIC_INIT(0);
+
+/** Topic names, in the order of linkTopic_t */
+static const char *const gTopicStr[LINK_TOPIC_COUNT] = {
+    MQTT_TOPIC,
+    MQTT_ALARM_TOPIC,
+#if defined(CONFIG_AQM_UART_BENCH)
+    MQTT_BENCH_TOPIC,
+#endif
+#if defined(CONFIG_AQM_TELEMETRY)
+    MQTT_TELEMETRY_TOPIC,
+#endif
+};
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+/** The topics as (short) MQTT-SN topic ids. Set at every connection */
+static uMqttSnTopicName_t gTopicName[LINK_TOPIC_COUNT];
+#endif
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Called by ubxlib when the broker disconnects */
+static void linkMqttDisconnectCb(int32_t errorCode, void *pParam)
+{
+    printk("MQTT Disconnected! (%d)\r\n", errorCode);
+    atomic_set(&gMqttUp, 0);
+}
+
+
+/** Called by ubxlib when the Wi-Fi connection status changes */
+static void linkWifiStatusCb(uDeviceHandle_t devHandle, int32_t connId, int32_t status,
+                             int32_t channel, char *pBssid, int32_t disconnectReason,
+                             void *pCallbackParameter)
+{
+    if( status == U_WIFI_CON_STATUS_CONNECTED ){
+        atomic_set(&gWifiUp, 1);
+    }
+    else{
+        printk("Wi-Fi Disconnected! (reason %d)\r\n", disconnectReason);
+        atomic_set(&gWifiUp, 0);
+        atomic_set(&gMqttUp, 0);
+    }
+}
+
+
+/** Makes the modules close their sockets, before Wi-Fi is brought down or
+ * the device is closed. The lock should be held */
+static void linkSocketsClose(void)
+{
+    for( int i = 0; i < gSocketCloseCbCount; i++ ){
+        gSocketCloseCb[i]();
+    }
+}
+
+
+/** Brings Wi-Fi up (again). The MQTT client and the sockets do not
+ * survive it */
+static int linkWifiUp(void)
+{
+    int32_t err;
+
+    linkSocketsClose();
+
+    if( gpMqttClientCtx != NULL ){
+        uMqttClientClose(gpMqttClientCtx);
+        gpMqttClientCtx = NULL;
+    }
+
+    if( gWifiEverUp ){
+        atomic_inc(&gWifiReconnects);
+        uNetworkInterfaceDown(gDevHandle, U_NETWORK_TYPE_WIFI);
+    }
+
+    printk("Bring up Wi-Fi\r\n");
+    err = uNetworkInterfaceUp(gDevHandle, U_NETWORK_TYPE_WIFI, gpWifiCfg);
+    if( err != 0 ){
+        printk("Could not connect to network (err %d)\r\n", err);
+        return (int)err;
+    }
+    gWifiEverUp = true;
+    atomic_set(&gWifiUp, 1);
+    printk("Wi-Fi connected\r\n");
+
+    // ubxlib uses its own callback while bringing the network up, so set
+    // ours after it
+    uWifiSetConnectionStatusCallback(gDevHandle, linkWifiStatusCb, NULL);
+
+    return 0;
+}
+
+
+/** Connects the MQTT (or MQTT-SN) client. Wi-Fi should be up */
+static int linkMqttUp(void)
+{
+    uint32_t startMs;
+    int32_t err;
+
+    if( gpMqttClientCtx == NULL ){
+        gpMqttClientCtx = pUMqttClientOpen(gDevHandle, NULL);
+        if( gpMqttClientCtx == NULL ){
+            printk("Could not open MQTT Client\r\n");
+            return -ENOMEM;
+        }
+    }
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+    if( !uMqttClientSnIsSupported(gpMqttClientCtx) ){
+        printk("MQTT-SN is not supported by this module, no uplink\r\n");
+        return -ENOTSUP;
+    }
+#endif
+
+    printk("uMqttClientConnect (%s)...", IS_ENABLED(CONFIG_AQM_UPLINK_MQTT_SN) ? "MQTT-SN" : "MQTT");
+    startMs = k_uptime_get_32();
+    err = uMqttClientConnect(gpMqttClientCtx, gpMqttConnection);
+    if( err != 0 ){
+        printk("failed (err %d)\r\n", err);
+        return (int)err;
+    }
+    printk("ok (%u ms)\r\n", k_uptime_get_32() - startMs);
+
+    uMqttClientSetDisconnectCallback(gpMqttClientCtx, linkMqttDisconnectCb, NULL);
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+    for( int i = 0; i < LINK_TOPIC_COUNT; i++ ){
+        if( ( i == LINK_TOPIC_MEASUREMENTS ) && ( CONFIG_AQM_MQTTSN_TOPIC_ID > 0 ) ){
+            // topic id predefined in the MQTT-SN gateway, nothing to exchange
+            err = uMqttClientSnSetTopicIdPredefined(CONFIG_AQM_MQTTSN_TOPIC_ID, &gTopicName[i]);
+        }
+        else{
+            // register the topic name once per connection, every publish then uses its id
+            err = uMqttClientSnRegisterNormalTopic(gpMqttClientCtx, gTopicStr[i], &gTopicName[i]);
+        }
+        if( err != 0 ){
+            printk("MQTT-SN topic \"%s\" could not be set (err %d)\r\n", gTopicStr[i], err);
+            uMqttClientDisconnect(gpMqttClientCtx);
+            return (int)err;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+/** Closes the connection to the broker and brings Wi-Fi down, on purpose
+ * (not an outage) */
+static void linkDown(void)
+{
+    linkSocketsClose();
+
+    atomic_set(&gMqttUp, 0);
+    if( gpMqttClientCtx != NULL ){
+        uMqttClientDisconnect(gpMqttClientCtx);
+        uMqttClientClose(gpMqttClientCtx);
+        gpMqttClientCtx = NULL;
+    }
+
+    if( atomic_get(&gWifiUp) ){
+        atomic_set(&gWifiUp, 0);
+        uNetworkInterfaceDown(gDevHandle, U_NETWORK_TYPE_WIFI);
+    }
+    // bringing it up again is not a reconnection
+    gWifiEverUp = false;
+}
+
+
+/** Asks NINA-W156 to switch its UART rate (with RTS/CTS) and opens it again
+ * at that rate. The link should be down */
+static int linkUartSwitch(int32_t baudRate)
+{
+    uAtClientHandle_t atHandle;
+    int32_t err;
+
+    err = uShortRangeAtClientHandleGet(gDevHandle, &atHandle);
+    if( err != 0 ){
+        return (int)err;
+    }
+
+    // AT+UMRS=<rate>,<flow control: RTS/CTS>,<8 data bits>,<1 stop bit>,
+    // <no parity>,<change after the OK>. Not stored: a reset goes back to
+    // the boot rate
+    uAtClientLock(atHandle);
+    uAtClientCommandStart(atHandle, "AT+UMRS=");
+    uAtClientWriteInt(atHandle, baudRate);
+    uAtClientWriteInt(atHandle, 1);
+    uAtClientWriteInt(atHandle, 8);
+    uAtClientWriteInt(atHandle, 1);
+    uAtClientWriteInt(atHandle, 1);
+    uAtClientWriteInt(atHandle, 1);
+    uAtClientCommandStopReadResponse(atHandle);
+    err = uAtClientUnlock(atHandle);
+    if( err != 0 ){
+        return (int)err;
+    }
+
+    uDeviceClose(gDevHandle, false);
+    gDevHandle = NULL;
+    k_sleep(K_MSEC(LINK_UART_SWITCH_MS));
+
+    // opening checks that the module answers at the new rate
+    gDeviceCfg.transportCfg.cfgUart.baudRate = baudRate;
+    return (int)uDeviceOpen(&gDeviceCfg, &gDevHandle);
+}
+
+
+#if defined(CONFIG_AQM_POWER_GATING)
+
+/** Removes the power of NINA-W156, or holds it in reset */
+static void linkPowerOff(void)
+{
+#if defined(CONFIG_AQM_POWER_GATING_RESET)
+    nina15ResetEnable();
+#else
+    nina15Disable();
+#endif
+}
+
+
+/** Powers NINA-W156 up again after a sleep and opens it, at the faster UART
+ * rate (it starts at the boot rate again) */
+static int linkPowerOn(void)
+{
+    if( nina15PowerUp(gBootBaudRate, CONFIG_AQM_NINA_STARTUP_TIMEOUT_MS) < 0 ){
+        printk("NINA-W15 did not answer in %d ms, opening it anyway\r\n",
+               CONFIG_AQM_NINA_STARTUP_TIMEOUT_MS);
+    }
+
+    gDeviceCfg.transportCfg.cfgUart.baudRate = gBootBaudRate;
+    if( uDeviceOpen(&gDeviceCfg, &gDevHandle) != 0 ){
+        gDevHandle = NULL;
+        linkPowerOff();
+        return -EIO;
+    }
+    uAtClientDebugSet(gDevHandle, false);
+
+    if( CONFIG_AQM_NINA_BAUD_RATE != gBootBaudRate ){
+        linkSetBaudRate(CONFIG_AQM_NINA_BAUD_RATE);
+    }
+
+    return 0;
+}
+
+#endif
+
+
+/** Powers NINA-W156 up, opens it with ubxlib and makes the first
+ * connection attempt, while the Gateway is already scanning */
+static void linkBringUpThread(void *p1, void *p2, void *p3)
+{
+    int32_t startupMs;
+    int err;
+
+    // route the UART of NINA-W156 to NORA-B1 (not to the USB bridge)
+    ninaNoraCommEnable();
+
+    startupMs = nina15PowerUp(gBootBaudRate, CONFIG_AQM_NINA_STARTUP_TIMEOUT_MS);
+    if( startupMs < 0 ){
+        printk("NINA-W15 did not answer in %d ms, opening it anyway\r\n",
+               CONFIG_AQM_NINA_STARTUP_TIMEOUT_MS);
+    }
+    else{
+        printk("NINA-W15 Powered on (ready after %d ms)\r\n", startupMs);
+    }
+
+    if( ( uPortInit() != 0 ) || ( uDeviceInit() != 0 ) ||
+        ( uDeviceOpen(&gDeviceCfg, &gDevHandle) != 0 ) ){
+        // the samples are stored as if the link was down
+        printk("NINA-W15 could not be opened, no uplink\r\n");
+        return;
+    }
+    atomic_set(&gNinaReadyMs, (atomic_val_t)k_uptime_get_32());
+
+    uAtClientDebugSet(gDevHandle, false);
+
+    // every publish goes through this UART, move it to the faster rate
+    // before connecting
+    if( CONFIG_AQM_NINA_BAUD_RATE != gBootBaudRate ){
+        linkSetBaudRate(CONFIG_AQM_NINA_BAUD_RATE);
+    }
+
+    // If it fails the uplink thread keeps retrying, the measurements are
+    // stored meanwhile
+    err = linkConnect();
+    if( ( err != 0 ) && ( err != -ENOTSUP ) ){
+        printk("Could not connect to the broker, retrying in the background\r\n");
+    }
+
+#if defined(CONFIG_AQM_UART_BENCH)
+    // before the uplink takes over, the link is not up for it yet
+    uartBenchRun();
+#endif
+
+    atomic_set(&gReady, 1);
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void linkInit(const uDeviceCfg_t *pDeviceCfg, const uNetworkCfgWifi_t *pWifiCfg,
+              const uMqttClientConnection_t *pMqttConnection)
+{
+    gDeviceCfg = *pDeviceCfg;
+    gBootBaudRate = pDeviceCfg->transportCfg.cfgUart.baudRate;
+    gpWifiCfg = pWifiCfg;
+    gpMqttConnection = pMqttConnection;
+}
+
+
+void linkStart(void)
+{
+    k_thread_create(&gBringUpThread, gBringUpStack,
+                    K_THREAD_STACK_SIZEOF(gBringUpStack),
+                    linkBringUpThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY), 0, K_NO_WAIT);
+    k_thread_name_set(&gBringUpThread, "bringup");
+}
+
+
+int linkSetBaudRate(int32_t baudRate)
+{
+    int err;
+
+    k_mutex_lock(&gLock, K_FOREVER);
+
+    linkDown();
+
+    err = linkUartSwitch(baudRate);
+    if( err != 0 ){
+        // The module may be at the new rate or at the old one: reset it,
+        // it starts at the boot rate again
+        printk("UART rate %d failed (err %d), back to %d\r\n", baudRate, err, gBootBaudRate);
+        if( gDevHandle != NULL ){
+            uDeviceClose(gDevHandle, false);
+            gDevHandle = NULL;
+        }
+        nina15PowerUp(gBootBaudRate, CONFIG_AQM_NINA_STARTUP_TIMEOUT_MS);
+
+        gDeviceCfg.transportCfg.cfgUart.baudRate = gBootBaudRate;
+        if( uDeviceOpen(&gDeviceCfg, &gDevHandle) != 0 ){
+            printk("NINA-W15 could not be opened again\r\n");
+        }
+        else{
+            uAtClientDebugSet(gDevHandle, false);
+        }
+    }
+    else{
+        uAtClientDebugSet(gDevHandle, false);
+        printk("UART rate %d baud\r\n", baudRate);
+    }
+
+    k_mutex_unlock(&gLock);
+
+    return err;
+}
+
+
+int linkConnect(void)
+{
+    int err;
+
+    k_mutex_lock(&gLock, K_FOREVER);
+
+    // Only bring Wi-Fi up again if it is down: if only the broker
+    // connection was lost, reconnecting MQTT is enough
+    if( !atomic_get(&gWifiUp) ){
+        err = linkWifiUp();
+    }
+    else{
+        err = 0;
+    }
+
+    if( err == 0 ){
+        err = linkMqttUp();
+    }
+
+    if( err == 0 ){
+        atomic_set(&gMqttUp, 1);
+        atomic_cas(&gFirstUpMs, 0, (atomic_val_t)k_uptime_get_32());
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+        gConnection++;
+#endif
+    }
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+    // the module firmware will not support it at the next attempt either
+    if( err == -ENOTSUP ){
+        atomic_set(&gNotSupported, 1);
+    }
+#endif
+
+    k_mutex_unlock(&gLock);
+
+    return err;
+}
+
+
+bool linkIsUp(void)
+{
+    // not up for the uplink until the bring-up thread is done with it
+    return atomic_get(&gReady) && ( atomic_get(&gMqttUp) != 0 );
+}
+
+
+bool linkIsWifiUp(void)
+{
+    return atomic_get(&gReady) && ( atomic_get(&gWifiUp) != 0 );
+}
+
+
+uDeviceHandle_t linkSocketLock(void)
+{
+    k_mutex_lock(&gLock, K_FOREVER);
+
+    if( !linkIsWifiUp() || ( gDevHandle == NULL ) ){
+        k_mutex_unlock(&gLock);
+        return NULL;
+    }
+
+    return gDevHandle;
+}
+
+
+void linkSocketUnlock(void)
+{
+    k_mutex_unlock(&gLock);
+}
+
+
+int linkAddSocketCloseCallback(void (*pCallback)(void))
+{
+    if( gSocketCloseCbCount >= LINK_MAX_SOCKET_CLOSE_CBS ){
+        return -ENOMEM;
+    }
+
+    gSocketCloseCb[gSocketCloseCbCount++] = pCallback;
+
+    return 0;
+}
+
+
+void linkCheck(void)
+{
+    // a publish in progress tells it anyway, do not wait for it
+    if( k_mutex_lock(&gLock, K_NO_WAIT) != 0 ){
+        return;
+    }
+    if( linkIsUp() && !uMqttClientIsConnected(gpMqttClientCtx) ){
+        atomic_set(&gMqttUp, 0);
+    }
+    k_mutex_unlock(&gLock);
+}
+
+
+int32_t linkService(void)
+{
+    uint32_t nowMs = k_uptime_get_32();
+    uint32_t outageMs;
+
+    if( linkIsUp() ){
+        return 0;
+    }
+
+    // still being brought up, not an outage
+    if( !atomic_get(&gReady) ){
+        return LINK_BRINGUP_POLL_MS;
+    }
+
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+    // stopped for good, told once when it happened
+    if( atomic_get(&gNotSupported) ){
+        return LINK_STOPPED_POLL_MS;
+    }
+#endif
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    // powered down on purpose, not an outage either
+    if( atomic_get(&gAsleep) ){
+        uint32_t wakeMs;
+
+        if( (int32_t)(gWakeMs - nowMs) > 0 ){
+            return (int32_t)(gWakeMs - nowMs);
+        }
+
+        if( linkPowerOn() != 0 ){
+            printk("NINA-W15 could not be opened, still powered down\r\n");
+            gWakeMs = k_uptime_get_32() + CONFIG_AQM_RECONNECT_MIN_MS;
+            return CONFIG_AQM_RECONNECT_MIN_MS;
+        }
+
+        atomic_set(&gAsleep, 0);
+        atomic_add(&gAsleepMs, (atomic_val_t)( nowMs - gSleepStartMs ));
+        gAwakeStartMs = nowMs;
+        atomic_inc(&gWakes);
+
+        // Wi-Fi comes up from scratch after a power cycle
+        if( linkConnect() == 0 ){
+            wakeMs = k_uptime_get_32() - nowMs;
+            atomic_set(&gWakeMsLast, (atomic_val_t)wakeMs);
+            atomic_add(&gWakeMsTotal, (atomic_val_t)wakeMs);
+            if( wakeMs > (uint32_t)atomic_get(&gWakeMsMax) ){
+                atomic_set(&gWakeMsMax, (atomic_val_t)wakeMs);
+            }
+            printk("Woke up and connected in %u ms\r\n", wakeMs);
+            return 0;
+        }
+
+        // powered but not connected: an outage from here
+        nowMs = k_uptime_get_32();
+    }
+#endif
+
+    // The callbacks only clear the flag, the outage is counted from here.
+    // The first reconnection attempt is immediate.
+    if( !gInOutage ){
+        gOutageStartMs = nowMs;
+        gNextAttemptMs = nowMs;
+        gInOutage = true;
+        atomic_inc(&gOutages);
+    }
+
+    if( (int32_t)(gNextAttemptMs - nowMs) > 0 ){
+        return (int32_t)(gNextAttemptMs - nowMs);
+    }
+
+    atomic_inc(&gAttempts);
+    if( linkConnect() != 0 ){
+        uint32_t delayMs = gBackoffMs;
+
+        // exponential backoff, up to the maximum
+        gNextAttemptMs = k_uptime_get_32() + delayMs;
+        gBackoffMs = MIN(gBackoffMs * 2, CONFIG_AQM_RECONNECT_MAX_S * 1000U);
+        printk("Reconnecting in %u ms\r\n", delayMs);
+
+        return (int32_t)delayMs;
+    }
+
+    outageMs = k_uptime_get_32() - gOutageStartMs;
+    atomic_set(&gLastOutageMs, (atomic_val_t)outageMs);
+    atomic_add(&gTotalOutageMs, (atomic_val_t)outageMs);
+    printk("Reconnected after %u ms\r\n", outageMs);
+
+    gInOutage = false;
+    gBackoffMs = CONFIG_AQM_RECONNECT_MIN_MS;
+
+    return 0;
+}
+
+
+#if defined(CONFIG_AQM_POWER_GATING)
+
+bool linkSleep(void)
+{
+    uint32_t nowMs = k_uptime_get_32();
+
+    if( !linkIsUp() || ( nowMs - gAwakeStartMs < CONFIG_AQM_POWER_GATING_MIN_AWAKE_MS ) ){
+        return false;
+    }
+
+    // a publish from another thread ends first
+    k_mutex_lock(&gLock, K_FOREVER);
+    linkDown();
+    uDeviceClose(gDevHandle, false);
+    gDevHandle = NULL;
+    linkPowerOff();
+    k_mutex_unlock(&gLock);
+
+    gSleepStartMs = nowMs;
+    gWakeMs = nowMs + CONFIG_AQM_POWER_GATING_PERIOD_S * 1000U;
+    atomic_add(&gAwakeMs, (atomic_val_t)( nowMs - gAwakeStartMs ));
+    atomic_inc(&gSleeps);
+    atomic_set(&gAsleep, 1);
+
+    return true;
+}
+
+
+void linkWakeNow(void)
+{
+    gWakeMs = k_uptime_get_32();
+}
+
+
+bool linkIsAsleep(void)
+{
+    return atomic_get(&gAsleep) != 0;
+}
+
+#endif
+
+
+int32_t linkPublish(const char *pMessage, size_t len)
+{
+    return linkPublishTopic(LINK_TOPIC_MEASUREMENTS, pMessage, len, false);
+}
+
+
+int32_t linkPublishTopic(linkTopic_t topic, const char *pMessage, size_t len, bool atLeastOnce)
+{
+    uMqttQos_t qos = atLeastOnce ? U_MQTT_QOS_AT_LEAST_ONCE : U_MQTT_QOS_AT_MOST_ONCE;
+    int32_t err;
+
+    k_mutex_lock(&gLock, K_FOREVER);
+
+    if( !atomic_get(&gMqttUp) ){
+        err = -ENOTCONN;
+    }
+    else{
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+        // the topic travels as a 2 byte topic id instead of its name
+        err = uMqttClientSnPublish(gpMqttClientCtx, &gTopicName[topic], pMessage, len,
+                                   qos, false);
+#else
+        err = uMqttClientPublish(gpMqttClientCtx, gTopicStr[topic], pMessage, len,
+                                 qos, false);
+#endif
+    }
+
+    k_mutex_unlock(&gLock);
+
+    return err;
+}
+
+
+int32_t linkPublishNamed(linkNamedTopic_t *pTopic, const char *pMessage, size_t len, bool retain)
+{
+    int32_t err = 0;
+
+    k_mutex_lock(&gLock, K_FOREVER);
+
+    if( !atomic_get(&gMqttUp) ){
+        err = -ENOTCONN;
+    }
+    else{
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+        // one registration per topic and connection, not per publish
+        if( pTopic->snConnection != gConnection ){
+            err = uMqttClientSnRegisterNormalTopic(gpMqttClientCtx, pTopic->name, &pTopic->snName);
+            if( err == 0 ){
+                pTopic->snConnection = gConnection;
+            }
+        }
+        if( err == 0 ){
+            err = uMqttClientSnPublish(gpMqttClientCtx, &pTopic->snName, pMessage, len,
+                                       U_MQTT_QOS_AT_MOST_ONCE, retain);
+        }
+#else
+        err = uMqttClientPublish(gpMqttClientCtx, pTopic->name, pMessage, len,
+                                 U_MQTT_QOS_AT_MOST_ONCE, retain);
+#endif
+    }
+
+    k_mutex_unlock(&gLock);
+
+    return err;
+}
+
+
+void linkGetStats(linkStats_t *pStats)
+{
+    pStats->outages = (uint32_t)atomic_get(&gOutages);
+    pStats->attempts = (uint32_t)atomic_get(&gAttempts);
+    pStats->wifiReconnects = (uint32_t)atomic_get(&gWifiReconnects);
+    pStats->lastOutageMs = (uint32_t)atomic_get(&gLastOutageMs);
+    pStats->totalOutageMs = (uint32_t)atomic_get(&gTotalOutageMs);
+    pStats->up = linkIsUp();
+    pStats->ninaReadyMs = (uint32_t)atomic_get(&gNinaReadyMs);
+    pStats->firstUpMs = (uint32_t)atomic_get(&gFirstUpMs);
+    pStats->baudRate = (uint32_t)gDeviceCfg.transportCfg.cfgUart.baudRate;
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    pStats->sleeps = (uint32_t)atomic_get(&gSleeps);
+    pStats->wakes = (uint32_t)atomic_get(&gWakes);
+    pStats->wakeMsLast = (uint32_t)atomic_get(&gWakeMsLast);
+    pStats->wakeMsTotal = (uint32_t)atomic_get(&gWakeMsTotal);
+    pStats->wakeMsMax = (uint32_t)atomic_get(&gWakeMsMax);
+    pStats->awakeMs = (uint32_t)atomic_get(&gAwakeMs);
+    pStats->asleepMs = (uint32_t)atomic_get(&gAsleepMs);
+
+    // add the period in progress
+    if( atomic_get(&gAsleep) ){
+        pStats->asleepMs += k_uptime_get_32() - gSleepStartMs;
+    }
+    else{
+        pStats->awakeMs += k_uptime_get_32() - gAwakeStartMs;
+    }
+#endif
+
+    // add the outage in progress
+    if( gInOutage ){
+        uint32_t currentMs = k_uptime_get_32() - gOutageStartMs;
+
+        pStats->lastOutageMs = currentMs;
+        pStats->totalOutageMs += currentMs;
+    }
+}
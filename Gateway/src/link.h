@@ -0,0 +1,255 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LINK_H__
+#define  LINK_H__
+
+/** @file
+ * @brief The link handles the connection of the Gateway to Thingstream via
+ * NINA-W156: Wi-Fi and MQTT (or MQTT-SN) on top of it, using ubxlib.
+ *
+ * When the connection is lost, the link is reconnected with exponential
+ * backoff (CONFIG_AQM_RECONNECT_MIN_MS up to CONFIG_AQM_RECONNECT_MAX_S).
+ * If Wi-Fi is still up only MQTT is reconnected, otherwise Wi-Fi is brought
+ * up again first.
+ *
+ * The module is brought up by a thread of its own (linkStart()), so the
+ * Gateway can scan meanwhile: it powers NINA-W156, waits until it answers,
+ * opens it, switches the UART to CONFIG_AQM_NINA_BAUD_RATE and makes the
+ * first connection attempt. Until then the link is down, without counting it
+ * as an outage.
+ *
+ * All the functions, except linkInit(), linkStart(), linkIsUp(),
+ * linkIsWifiUp(), linkSocketLock(), linkSocketUnlock(), linkPublishTopic(),
+ * linkPublishNamed() and linkGetStats(), should be called from the same
+ * thread (the uplink thread, after the first connection). A publish from another thread
+ * waits for a reconnection in progress to end.
+ *
+ * Other modules may use sockets of NINA-W156, under the link lock (see
+ * linkSocketLock()). They are told to close them, with the lock held,
+ * before the sockets are lost: Wi-Fi brought down or up again, or the
+ * device closed (UART rate switch, power gating).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ubxlib.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Maximum length of the name of a linkNamedTopic_t, terminator included */
+#define LINK_TOPIC_NAME_MAX_LEN     32
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** The topics the Gateway publishes to */
+typedef enum{
+    LINK_TOPIC_MEASUREMENTS,    /**< Batches of samples or rollups */
+    LINK_TOPIC_ALARM,           /**< Samples over the alarm threshold */
+#if defined(CONFIG_AQM_UART_BENCH)
+    LINK_TOPIC_BENCH,           /**< Messages of the UART benchmark */
+#endif
+#if defined(CONFIG_AQM_TELEMETRY)
+    LINK_TOPIC_TELEMETRY,       /**< Snapshots of the Gateway metrics */
+#endif
+    LINK_TOPIC_COUNT
+}linkTopic_t;
+
+/** A topic not known in advance (e.g. one per broadcaster). Its name is
+ * built once by its owner, with MQTT-SN its topic id is registered at the
+ * first publish of every connection */
+typedef struct{
+    char name[LINK_TOPIC_NAME_MAX_LEN]; /**< Topic name, empty until built */
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+    uMqttSnTopicName_t snName;          /**< Topic id, valid in connection snConnection */
+    uint32_t snConnection;              /**< Connection the id was registered in, zero if never */
+#endif
+}linkNamedTopic_t;
+
+/** Statistics of the link */
+typedef struct{
+    uint32_t outages;           /**< Times the connection was lost */
+    uint32_t attempts;          /**< Reconnection attempts */
+    uint32_t wifiReconnects;    /**< Reconnections which needed to bring Wi-Fi up again */
+    uint32_t lastOutageMs;      /**< Duration (msec) of the last outage, or of the current one */
+    uint32_t totalOutageMs;     /**< Total duration (msec) of the outages, including the current one */
+    bool up;                    /**< Connected to the broker now */
+    uint32_t ninaReadyMs;       /**< Uptime (msec) when NINA-W156 was open, zero if not yet */
+    uint32_t firstUpMs;         /**< Uptime (msec) of the first connection, zero if not yet */
+    uint32_t baudRate;          /**< UART rate to NINA-W156 */
+#if defined(CONFIG_AQM_POWER_GATING)
+    uint32_t sleeps;            /**< Times NINA-W156 was powered down between uploads */
+    uint32_t wakes;             /**< Times it was powered up again */
+    uint32_t wakeMsLast;        /**< Power up to connected (msec), last wake-up */
+    uint32_t wakeMsTotal;       /**< Total power up to connected time (msec) */
+    uint32_t wakeMsMax;         /**< Longest power up to connected time (msec) */
+    uint32_t awakeMs;           /**< Time (msec) NINA-W156 was powered, including now */
+    uint32_t asleepMs;          /**< Time (msec) it was powered down, including now */
+#endif
+}linkStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Initializes the link. The configurations should stay valid.
+ *
+ * @param pDeviceCfg       The NINA-W156 device configuration (ubxlib).
+ * @param pWifiCfg         The Wi-Fi network configuration.
+ * @param pMqttConnection  The MQTT (or MQTT-SN) connection parameters.
+ */
+void linkInit(const uDeviceCfg_t *pDeviceCfg, const uNetworkCfgWifi_t *pWifiCfg,
+              const uMqttClientConnection_t *pMqttConnection);
+
+/** Starts the thread bringing NINA-W156 up and making the first connection
+ *  attempt. Returns at once.
+ */
+void linkStart(void);
+
+/** Switches the UART to NINA-W156 to another rate, with RTS/CTS. If the
+ *  module does not answer at the new rate it is reset and opened again at
+ *  its boot rate. If connected, the connection is closed: connect again
+ *  with linkConnect(). Called by the bring-up thread.
+ *
+ * @param baudRate  The new rate (baud).
+ * @return          zero on success else negative error code (back to the
+ *                  boot rate).
+ */
+int linkSetBaudRate(int32_t baudRate);
+
+/** Connects to the broker (Wi-Fi first, if not up). One attempt, blocks
+ *  until it succeeds or fails.
+ *
+ * @return  zero on success else negative error code.
+ */
+int linkConnect(void);
+
+/** Checks if the link is connected to the broker.
+ *
+ * @return  true if connected.
+ */
+bool linkIsUp(void);
+
+/** Checks if Wi-Fi is up, whether or not the broker is connected.
+ *
+ * @return  true if Wi-Fi is up.
+ */
+bool linkIsWifiUp(void);
+
+/** Locks the link for socket calls on NINA-W156, so the device is not
+ *  closed meanwhile. Publishes wait for the lock: only short calls.
+ *
+ * @return  the ubxlib device handle, locked until linkSocketUnlock(), or
+ *          NULL (not locked) if Wi-Fi is down.
+ */
+uDeviceHandle_t linkSocketLock(void);
+
+/** Unlocks the link after linkSocketLock() returned a device.
+ */
+void linkSocketUnlock(void);
+
+/** Registers the function closing the sockets of a module, called with the
+ *  link locked before they are lost. Should be called before the module
+ *  uses sockets.
+ *
+ * @param pCallback  The function.
+ * @return           zero on success, -ENOMEM if too many are registered.
+ */
+int linkAddSocketCloseCallback(void (*pCallback)(void));
+
+/** Asks the MQTT client if it is still connected to the broker and marks
+ *  the link down if not (e.g. after a failed publish).
+ */
+void linkCheck(void);
+
+/** Reconnects the link if it is down and the backoff time has elapsed.
+ *
+ * @return  zero if the link is up, else the time (msec) until the next
+ *          reconnection attempt (or until looking again, while the module
+ *          is being brought up).
+ */
+int32_t linkService(void);
+
+/** Powers NINA-W156 down until the next upload, in
+ *  CONFIG_AQM_POWER_GATING_PERIOD_S (CONFIG_AQM_POWER_GATING): the link is
+ *  then down, without counting it as an outage, until linkService() powers
+ *  it up and connects again. Does nothing if the link is down or was up
+ *  for less than CONFIG_AQM_POWER_GATING_MIN_AWAKE_MS.
+ *
+ * @return  true if NINA-W156 was powered down.
+ */
+bool linkSleep(void);
+
+/** Makes the next linkService() wake NINA-W156 up, without waiting for the
+ *  next upload (e.g. for an alarm).
+ */
+void linkWakeNow(void);
+
+/** Checks if NINA-W156 is powered down between uploads.
+ *
+ * @return  true if powered down.
+ */
+bool linkIsAsleep(void);
+
+/** Publishes a message to the measurements topic (QoS 0).
+ *
+ * @param pMessage  The message.
+ * @param len       Length of the message.
+ * @return          zero on success else negative error code.
+ */
+int32_t linkPublish(const char *pMessage, size_t len);
+
+/** Publishes a message to a topic.
+ *
+ * @param topic        The topic.
+ * @param pMessage     The message.
+ * @param len          Length of the message.
+ * @param atLeastOnce  true for QoS 1, false for QoS 0.
+ * @return             zero on success (with QoS 1: acknowledged by the
+ *                     broker), -ENOTCONN if the link is down, else negative
+ *                     error code.
+ */
+int32_t linkPublishTopic(linkTopic_t topic, const char *pMessage, size_t len, bool atLeastOnce);
+
+/** Publishes a message to a named topic, with QoS 0.
+ *
+ * @param pTopic    The topic, its name built.
+ * @param pMessage  The message.
+ * @param len       Length of the message.
+ * @param retain    true if the broker should keep it as the last message
+ *                  of the topic, for the next subscribers.
+ * @return          zero on success, -ENOTCONN if the link is down, else
+ *                  negative error code.
+ */
+int32_t linkPublishNamed(linkNamedTopic_t *pTopic, const char *pMessage, size_t len, bool retain);
+
+/** Gets a snapshot of the link statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void linkGetStats(linkStats_t *pStats);
+
+
+#endif // LINK_H__
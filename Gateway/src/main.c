@@ -26,13 +26,15 @@
  *  - Connects to WiFi via NINA-W156
  *  - Connects to thingstream via MQTT
  *  - Scans for Bluetooth LE devices
- *  - Finds among scanned devices the one named as the scd4x_broadcaster
- *  - Gets the address of that device and then parses the data from this device only
+ *  - Finds among scanned devices the ones named as the scd4x_broadcaster
+ *  - Keeps the address (and state) of those devices in a device table and then
+ *    parses the data from those devices only
  *  - Each measurement may be bradcasted several times from scd4x_broadcaster. This
- *    application recognizes the meaurement id of each measurement and if already
- *    read it ignores it, until the next measurement comes (different measurement id)
- * -  Each time a new measurement is received, a JSON message is prepared and sent 
- *    to Thingstream (you can then see those measurements in the Dashboard that comes
+ *    application recognizes the meaurement id of each measurement (per device) and if
+ *    already read it ignores it, until the next measurement comes (different measurement id)
+ * -  Each time a new measurement is received, it is put in the ingest queue. The
+ *    uplink thread blocks on that queue, packs the measurements in batches
+ *    (JSON messages holding many measurements) and sends them to Thingstream (you can then see those measurements in the Dashboard that comes
  *    with this example)
  */
 
@@ -44,11 +46,27 @@
 #include <string.h>
 
 #include <bluetooth/bluetooth.h>
-#include <bluetooth/hci.h>
 
 #include "ubxlib.h"
 
-#include "nina_config.h"
+#include "device_table.h"
+#include "ingest_queue.h"
+#include "scanner.h"
+#include "scan_schedule.h"
+#include "aggregate.h"
+#include "alarm.h"
+#include "deadband.h"
+#include "flash_log.h"
+#include "inflight.h"
+#include "lan_udp.h"
+#include "last_value.h"
+#include "link.h"
+#include "ownership.h"
+#include "store_ring.h"
+#include "telemetry.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "uplink.h"
 
 
 /* ----------------------------------------------------------------
@@ -59,10 +77,6 @@
 #define WIFI_SSID       "your_ssid"
 #define WIFI_PASSWORD   "your_password"
 
-// Topic name where the received measurements are going to be published
-// Should be defined to Thingstream as well
-#define MQTT_TOPIC "airquality"
-
 // MQTT broked credentials
 #define MQTT_BROKER_NAME    "mqtt.thingstream.io"
 #define MQTT_PORT           1883  
@@ -70,47 +84,9 @@
 #define MQTT_USERNAME       "Paste and copy IP thing username here"
 #define MQTT_PASSWORD       "Paste and copy IP thing password here"
 
-// The name of the broadcaster (under which name the broadcaster advertises)
-#define BROADCASTER_NAME    "ZephyrAQM"
-
-
-/* ----------------------------------------------------------------
- * GLOBALS
- * -------------------------------------------------------------- */
-
-/** Structure holding the measurements of the SCD41 sensor along with
- * an ascending number which is used as a message id, to separate the
- * measurement messages
- * Note: This struct declaration should be the same as the one used by the
- * broadcaster
- */
-struct{
-	float temperature;     /**< Temperature measurement */                  
-	float humitity;        /**< Humidity measurement */                      
-	float co2;             /**< CO2 measurement */                           
-	uint32_t message_id;   /**< Ascending number to identify measurement */
-}gMeasurement = {0};
-
-
-//uint8_t adv_data[ sizeof(float)*3 ]= { 0 };
-
-/** Message to be pubished via MQTT*/
-char gMessageToPublish[200] = "";
-
-//uint8_t adv_dataheader[16] = {};
-
-/** Has the address of the Sensor broadcaster been obtained? */
-static bool gAddressObtained = false;
-
-/** The address of the broadcaster */
-bt_addr_t gAddress;
-
-/** The last measurement(message) ID obtained*/
-uint32_t gLastMeasId = 0;
-
-/** When a new measurement has been received */
-static bool gMeasReceived = false;
-
+// MQTT-SN gateway, used instead of the broker with CONFIG_AQM_UPLINK_MQTT_SN
+// (address:port, e.g. a local MQTT-SN gateway for testing)
+#define MQTTSN_GATEWAY_NAME "Paste MQTT-SN gateway address:port here"
 
 /* ----------------------------------------------------------------
  * MACROS
@@ -130,25 +106,6 @@ static bool gMeasReceived = false;
  * STATIC FUNCTION DECLARATION
  * -------------------------------------------------------------- */
 
-/** The scan callback to be executed when a new device is found be the BLE scanner
- * 
- * @param addr       See bt_le_scan_cb_t description.
- * @param rssi       See bt_le_scan_cb_t description.
- * @param adv_type   See bt_le_scan_cb_t description.
- * @param buf        See bt_le_scan_cb_t description.
- */
-static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
-		    struct net_buf_simple *buf);
-
-
-/** Callback to be executed when the device disconnects from MQTT broker.
- *
- * @param adv_type  See uMqttClientSetDisconnectCallback description.
- * @param buf       See uMqttClientSetDisconnectCallback description.
-*/
-static void mqttDisconnectCb(int32_t errorCode, void *pParam);
-
-
 /** Function to be called when something fails. Halts execution. 
  * 
  * @param msg       Message to be typed before halt.
@@ -156,28 +113,9 @@ static void mqttDisconnectCb(int32_t errorCode, void *pParam);
 static void failed(const char *msg);
 
 
-/** To be used as a parameter of bt_data_parse() within the scan callback.
- *  Checks if the scanned device name is the one requested by
- *  BROADCASTER_NAME definition
- * 
- *  @param data       see bt_data_parse() description.
- *  @param user_data  see bt_data_parse() description. Returns true if 
- *                    requested device name is found. 
- *  @return           see bt_data_parse() description.
+/** Prints the statistics of the gateway pipeline on the console.
  */
-static bool adv_check_name(struct bt_data *data, void *name_found);
-
-
-/** To be used as a parameter of bt_data_parse() within the scan callback.
- *  Checks the advertising packet type and the data within it.
- *  If a NEW measurement has been received, it popoulates the gMeasurement struct
- *  and sets the gMeasReceived boolean to true.
- * 
- *  @param data       see bt_data_parse() description.
- *  @param user_data  see bt_data_parse() description.
- *  @return           see bt_data_parse() description.
- */
-static bool adv_data_found(struct bt_data *data, void *user_data);
+static void printStats(void);
 
 
 /** Function description goes here.
@@ -199,116 +137,326 @@ static void failed(const char *msg)
 }
 
 
-static bool adv_check_name(struct bt_data *data, void *name_found)
-{
-    // set name_found parameter to false
-    memset(name_found,0,1);
-
-    // check advertisement's AD type byte. 0x09 is for: Complete Local Name 
-    // we are only interested in that
-    if( data->type != 9 )
-        return false;
-    
-    // check if the name has the expected length
-    if( data->data_len != strlen( BROADCASTER_NAME ) )
-        return false;
-
-    // check the name itself
-    if( memcmp( data->data, BROADCASTER_NAME, strlen( BROADCASTER_NAME ) ) == 0 ){
-        // name found, set name_found to true
-        memset(name_found,1,1); 
-        return true;
-    }
-
-    return false;
-}
-
-
-static bool adv_data_found(struct bt_data *data, void *user_data)
+static void printStats(void)
 {
-    // check advertisement's AD type byte. 0x255 contains measurement data
-    // we are only interested in that
-    if( data->type != 255 )
-        return false;
-
-    // copy the advertisement data to the measurement structure. For this to
-    // work, gMeasurement should be defined exactly the same in the sensor 
-    // broadcaster and the receiver/Gateway. The same MCU is also used in both sides,
-    // so its safe to use for this example.
-    memcpy( &gMeasurement, data->data, sizeof(gMeasurement) );
-
-    // We only need to check if the id is different than the previous measurement 
-    // received. If it's higher or lower is not really of interest, because we only
-    // want to exclude measurements multiply broadcasted. So, if the last measurement
-    // we got had the same id, then this is a repetition of the previous message and
-    // we abort it.
-    if( gLastMeasId != gMeasurement.message_id ){
-        
-        printf("New measurement received\r\n");
-
-        // print measurement
-        printf( "Temp: %f  : Hum:%f   Co2: %f Id: %d \r\n", 
-                 gMeasurement.temperature,
-                 gMeasurement.humitity,
-                 gMeasurement.co2,
-                 gMeasurement.message_id);
-
-        // Notify for a new measurement and keep its ID
-        gLastMeasId = gMeasurement.message_id;
-        gMeasReceived = true;
-
-        return true;
+    scannerStats_t scanStats;
+    ingestQueueStats_t queueStats;
+    uplinkStats_t uplinkStats;
+    linkStats_t linkStats;
+    storeRingStats_t ringStats;
+    static uint32_t prevPublished;
+    uint32_t nowMs = k_uptime_get_32();
+    int deviceCount = (int)deviceTableCount();
+
+    scannerGetStats(&scanStats);
+    ingestQueueGetStats(&queueStats);
+    uplinkGetStats(&uplinkStats);
+    linkGetStats(&linkStats);
+    storeRingGetStats(&ringStats);
+
+    printk("Stats: adverts seen %u, matched %u, broadcasters %u/%u (ignored, table full: %u)\r\n",
+            scanStats.advSeen,
+            scanStats.advMatched,
+            deviceCount,
+            CONFIG_AQM_MAX_DEVICES,
+            scanStats.tableFull);
+
+    printk("Stats: duplicates dropped %u, reordered %u, stale dropped %u, reboots %u\r\n",
+            scanStats.duplicates,
+            scanStats.reordered,
+            scanStats.stale,
+            scanStats.reboots);
+
+    printk("Stats: discovery scans %u, accept list %u/%d broadcasters, filtered scan time %u s\r\n",
+            scanStats.discoveries,
+            scanStats.acceptListLen,
+#if defined(CONFIG_AQM_SCAN_ACCEPT_LIST)
+            CONFIG_AQM_SCAN_ACCEPT_LIST_SIZE,
+#else
+            0,
+#endif
+            scanStats.filteredMs / 1000);
+
+    // scan duty cycle in permille of the time since scanning started
+    printk("Stats: scan time %u s of %u s (duty cycle %u permille)\r\n",
+            scanStats.scanOnMs / 1000,
+            scanStats.elapsedMs / 1000,
+            ( scanStats.elapsedMs > 0 ) ?
+                (uint32_t)( (uint64_t)scanStats.scanOnMs * 1000 / scanStats.elapsedMs ) : 0);
+
+#if defined(CONFIG_AQM_SCAN_SCHEDULE)
+    scanScheduleStats_t schedStats;
+
+    scanScheduleGetStats(&schedStats);
+    printk("Stats: scan windows %u (closed early %u), bursts expected %u, missed %u (miss rate %u permille), resyncs %u\r\n",
+            schedStats.windows,
+            schedStats.earlyClosed,
+            schedStats.expected,
+            schedStats.missed,
+            ( schedStats.expected > 0 ) ?
+                (uint32_t)( (uint64_t)schedStats.missed * 1000 / schedStats.expected ) : 0,
+            schedStats.resyncs);
+#endif
+
+    printk("Stats: queued %u, dropped %u, queue depth %u (max %u/%u)\r\n",
+            queueStats.enqueued,
+            queueStats.dropped,
+            queueStats.depth,
+            queueStats.maxDepth,
+            CONFIG_AQM_INGEST_QUEUE_LEN);
+
+    // message rate since the previous printout
+    printk("Stats: published %u messages (%u per min), %u samples (%u per message), %u bytes, failed %u messages (%u samples)\r\n",
+            uplinkStats.published,
+            ( uplinkStats.published - prevPublished ) * 60 / CONFIG_AQM_STATS_PRINT_PERIOD_S,
+            uplinkStats.samplesPublished,
+            ( uplinkStats.published > 0 ) ? uplinkStats.samplesPublished / uplinkStats.published : 0,
+            uplinkStats.bytesPublished,
+            uplinkStats.failed,
+            uplinkStats.samplesFailed);
+    prevPublished = uplinkStats.published;
+
+    printk("Stats: %s publish time %u ms average, %u ms max\r\n",
+            IS_ENABLED(CONFIG_AQM_UPLINK_MQTT_SN) ? "MQTT-SN" : "MQTT",
+            ( uplinkStats.published + uplinkStats.failed > 0 ) ?
+                uplinkStats.publishMsTotal / ( uplinkStats.published + uplinkStats.failed ) : 0,
+            uplinkStats.publishMsMax);
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+    inflightStats_t inflightStats;
+
+    inflightGetStats(&inflightStats);
+    printk("Stats: QoS 1 window %u/%d (max %u), acknowledged %u messages (%u samples), ack time %u ms average, %u ms max, retransmits %u, dropped %u messages (%u samples)\r\n",
+            inflightStats.depth,
+            CONFIG_AQM_INFLIGHT_WINDOW,
+            inflightStats.maxDepth,
+            inflightStats.acked,
+            inflightStats.samplesAcked,
+            ( inflightStats.acked > 0 ) ? inflightStats.ackMsTotal / inflightStats.acked : 0,
+            inflightStats.ackMsMax,
+            inflightStats.retransmits,
+            inflightStats.dropped,
+            inflightStats.samplesDropped);
+#endif
+
+    printk("Stats: %s payload, %u bytes per sample, encoding %u ns per sample\r\n",
+            IS_ENABLED(CONFIG_AQM_PAYLOAD_CBOR) ? "CBOR" : "JSON",
+            ( uplinkStats.samplesPublished > 0 ) ? uplinkStats.bytesPublished / uplinkStats.samplesPublished : 0,
+            ( uplinkStats.encoded > 0 ) ? (uint32_t)( uplinkStats.encodeNs / uplinkStats.encoded ) : 0);
+
+    printk("Stats: batch limits %d samples, %d bytes, %d ms; flushed when full %u, out of bytes %u, too old %u, before powering down %u\r\n",
+            CONFIG_AQM_BATCH_MAX_SAMPLES,
+            CONFIG_AQM_BATCH_MAX_BYTES,
+            CONFIG_AQM_BATCH_MAX_AGE_MS,
+            uplinkStats.flushCount,
+            uplinkStats.flushBytes,
+            uplinkStats.flushAge,
+            uplinkStats.flushSleep);
+
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+    aggregateStats_t aggStats;
+
+    aggregateGetStats(&aggStats);
+    printk("Stats: aggregated %u samples into %u rollups, windows closed %u\r\n",
+            aggStats.samples,
+            aggStats.rollups,
+            aggStats.windows);
+#endif
+
+#if defined(CONFIG_AQM_ALARM)
+    alarmStats_t alarmStats;
+
+    alarmGetStats(&alarmStats);
+    printk("Stats: CO2 alarms raised %u, cleared %u, active %u; alarm samples published %u (%u ms average, %u ms max from reception), failed %u\r\n",
+            alarmStats.raised,
+            alarmStats.cleared,
+            alarmStats.active,
+            alarmStats.published,
+            ( alarmStats.published > 0 ) ? alarmStats.latencyMsTotal / alarmStats.published : 0,
+            alarmStats.latencyMsMax,
+            alarmStats.failed);
+#endif
+
+#if defined(CONFIG_AQM_LAST_VALUE)
+    lastValueStats_t lastValueStats;
+
+    lastValueGetStats(&lastValueStats);
+    printk("Stats: last values published %u, replaced before publish %u, failed %u, pending %u\r\n",
+            lastValueStats.published,
+            lastValueStats.replaced,
+            lastValueStats.failed,
+            lastValueStats.pending);
+#endif
+
+    printk("Stats: boot to first sample %u ms, to NINA-W15 open %u ms, to first connection %u ms, to first publish %u ms\r\n",
+            uplinkStats.firstSampleMs,
+            linkStats.ninaReadyMs,
+            linkStats.firstUpMs,
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+            inflightStats.firstAckMs);
+#else
+            uplinkStats.firstPublishMs);
+#endif
+
+    printk("Stats: link %s (UART %u baud), outages %u (last %u ms, total %u s), reconnection attempts %u, Wi-Fi reconnections %u\r\n",
+            linkStats.up ? "up" : "down",
+            linkStats.baudRate,
+            linkStats.outages,
+            linkStats.lastOutageMs,
+            linkStats.totalOutageMs / 1000,
+            linkStats.attempts,
+            linkStats.wifiReconnects);
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    // NINA-W156 charge (uA x msec) and energy (mJ), from the configured
+    // currents: with power gating, and if it had stayed awake
+    uint64_t gatedCharge = (uint64_t)linkStats.awakeMs * CONFIG_AQM_POWER_NINA_AWAKE_MA * 1000 +
+                           (uint64_t)linkStats.asleepMs * CONFIG_AQM_POWER_NINA_ASLEEP_UA;
+    uint64_t alwaysOnCharge = (uint64_t)( linkStats.awakeMs + linkStats.asleepMs ) *
+                              CONFIG_AQM_POWER_NINA_AWAKE_MA * 1000;
+    uint32_t samples = MAX(uplinkStats.samplesPublished, 1);
+
+    printk("Stats: NINA-W15 powered down %u times, awake %u%% of the time, power up to connected %u ms (average %u ms, max %u ms); energy per sample published %u mJ (always on %u mJ)\r\n",
+            linkStats.sleeps,
+            ( linkStats.awakeMs + linkStats.asleepMs > 0 ) ?
+                (uint32_t)( 100ULL * linkStats.awakeMs / ( linkStats.awakeMs + linkStats.asleepMs ) ) : 100,
+            linkStats.wakeMsLast,
+            ( linkStats.wakes > 0 ) ? linkStats.wakeMsTotal / linkStats.wakes : 0,
+            linkStats.wakeMsMax,
+            (uint32_t)( gatedCharge * CONFIG_AQM_POWER_NINA_SUPPLY_MV / 1000000000ULL / samples ),
+            (uint32_t)( alwaysOnCharge * CONFIG_AQM_POWER_NINA_SUPPLY_MV / 1000000000ULL / samples ));
+#endif
+
+#if defined(CONFIG_AQM_OWNERSHIP)
+    ownershipStats_t ownStats;
+
+    ownershipGetStats(&ownStats);
+    printk("Stats: ownership %u peers, samples published %u, left to peers %u; duplicate uploads without ownership %u%%, with %u%%; takeovers %u, handovers %u; beacons sent %u, received %u\r\n",
+            ownStats.peers,
+            ownStats.published,
+            ownStats.yielded,
+            ( ownStats.received > 0 ) ? (uint32_t)( 100 - ownStats.uniquePermille / 10 / ownStats.received ) : 0,
+            ( ownStats.published > 0 ) ? 100 * ownStats.duplicates / ownStats.published : 0,
+            ownStats.takeovers,
+            ownStats.handovers,
+            ownStats.beaconsSent,
+            ownStats.beaconsReceived);
+#endif
+
+#if defined(CONFIG_AQM_LAN_UDP)
+    lanUdpStats_t lanStats;
+
+    lanUdpGetStats(&lanStats);
+    printk("Stats: LAN datagrams sent %u (%u ms max from reception), failed %u, dropped %u\r\n",
+            lanStats.sent,
+            lanStats.latencyMsMax,
+            lanStats.failed,
+            lanStats.dropped);
+#endif
+
+#if defined(CONFIG_AQM_TIME_SYNC)
+    timeSyncStats_t timeStats;
+
+    timeSyncGetStats(&timeStats);
+    printk("Stats: time syncs %u, failed %u, last %u s ago (round-trip %u ms, step %d ms)\r\n",
+            timeStats.syncs,
+            timeStats.failures,
+            ( timeStats.lastSyncMs > 0 ) ? ( k_uptime_get_32() - timeStats.lastSyncMs ) / 1000 : 0,
+            timeStats.lastRttMs,
+            timeStats.lastStepMs);
+#endif
+
+#if defined(CONFIG_AQM_TELEMETRY)
+    telemetryStats_t telemetryStats;
+
+    telemetryGetStats(&telemetryStats);
+    printk("Stats: telemetry snapshots sent %u, failed %u, last %u bytes\r\n",
+            telemetryStats.sent,
+            telemetryStats.failed,
+            telemetryStats.lastLen);
+#endif
+
+#if defined(CONFIG_AQM_TRACE)
+    // where the time goes, from the sensor fetch to the publish return
+    for( int i = 0; i < TRACE_STAGE_COUNT; i++ ){
+        traceStageStats_t stage;
+        const char *pUnit = ( i == TRACE_STAGE_CALLBACK ) ? "us" : "ms";
+
+        traceGetStage(i, &stage);
+        printk("Stats: latency %-9s %5u samples, average %u %s, p50 %u, p90 %u, p99 %u, max %u %s\r\n",
+                traceStageName(i),
+                stage.count,
+                ( stage.count > 0 ) ? (uint32_t)( stage.total / stage.count ) : 0,
+                pUnit,
+                tracePercentile(&stage, 500),
+                tracePercentile(&stage, 900),
+                tracePercentile(&stage, 990),
+                stage.max,
+                pUnit);
     }
-    else{
-        // measurement already received. This is a repetition,
-        // abort measurement
-        return false;
+#endif
+
+    printk("Stats: stored %u, forwarded %u, dropped %u, ring depth %u (max %u/%u), stride %u\r\n",
+            ringStats.queued,
+            ringStats.drained,
+            ringStats.dropped,
+            ringStats.depth,
+            ringStats.maxDepth,
+            CONFIG_AQM_STORE_RING_LEN,
+            ringStats.stride);
+
+#if defined(CONFIG_AQM_FLASH_LOG)
+    flashLogStats_t logStats;
+
+    flashLogGetStats(&logStats);
+    printk("Stats: flash log stored %u, replayed %u, to replay %u, lost %u, cursor writes %u, sectors erased %u, CRC errors %u\r\n",
+            logStats.stored,
+            logStats.replayed,
+            logStats.unread,
+            logStats.lost,
+            logStats.committed,
+            logStats.erased,
+            logStats.crcErrors);
+#endif
+
+    for( int i = 0; i < deviceCount; i++ ){
+        const deviceEntry_t *pDevice = deviceTableGet(i);
+        char addrStr[BT_ADDR_LE_STR_LEN];
+
+        bt_addr_le_to_str(&pDevice->addr, addrStr, sizeof(addrStr));
+        printk("  [%d] %s rssi %d, seen %u ms ago, adverts %u, samples %u, last id %u, dup %u, reord %u, stale %u, reboots %u\r\n",
+                i, addrStr,
+                pDevice->rssi,
+                nowMs - pDevice->lastSeenMs,
+                pDevice->advCount,
+                pDevice->sampleCount,
+                pDevice->lastMsgId,
+                pDevice->duplicates,
+                pDevice->reordered,
+                pDevice->stale,
+                pDevice->reboots);
+
+#if defined(CONFIG_AQM_DEADBAND)
+        deadbandStats_t dbStats;
+        uint32_t sent;
+        uint32_t total;
+
+        deadbandGetStats(i, &dbStats);
+        sent = dbStats.forwarded + dbStats.heartbeats;
+        total = sent + dbStats.suppressed;
+        // published per hour of uptime, and the share of the samples saved
+        printk("      deadband: published %u of %u (changed %u, heartbeat %u), %u per hour, %u%% saved\r\n",
+                sent,
+                total,
+                dbStats.forwarded,
+                dbStats.heartbeats,
+                (uint32_t)( (uint64_t)sent * 3600000U / MAX(nowMs, 1U) ),
+                ( total > 0 ) ? dbStats.suppressed * 100 / total : 0);
+#endif
     }
 }
 
 
-static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
-		    struct net_buf_simple *buf)
-{
-    // search for Broadcaster device name and obtain its address
-    if( !gAddressObtained ){
-
-        //parse advertisement packet and search for device name
-        bool name_found = false;
-        bt_data_parse(buf, adv_check_name, &name_found);
-        
-        if( name_found ){
-            printf( "Found Broadcaster Name. " );
-            //save address
-            gAddress = addr->a;
-            gAddressObtained = true;
-
-            printk("Address: %02x:%02x:%02x:%02x:%02x:%02x\r\n", 
-                    gAddress.val[5],
-                    gAddress.val[4],
-                    gAddress.val[3],
-                    gAddress.val[2],
-                    gAddress.val[1],
-                    gAddress.val[0]);
-        }   
-    }
-
-    // if address has been obtained
-    if( gAddressObtained ){
-        // if the scanned device has the expected address
-        if ( memcmp(addr->a.val, gAddress.val, sizeof(gAddress.val) ) == 0 ){
-            // parse data to get measurement
-            bt_data_parse(buf, adv_data_found, NULL);
-       }
-    }       
-}
-
-
-static void mqttDisconnectCb(int32_t errorCode, void *pParam){
-    printk("MQTT Disconnected! \r\n");
-}
-
-
 /* ----------------------------------------------------------------
  * MAIN APPLICATION IMPLEMENTATION
  * -------------------------------------------------------------- */
@@ -317,9 +465,6 @@ static void mqttDisconnectCb(int32_t errorCode, void *pParam){
 void main(void)
 {
 
-    uMqttClientContext_t *mqttClientCtx; 
-    static uDeviceHandle_t gDevHandle = NULL;
-
     // Wi-Fi module config for use by ubxlib
     static const uDeviceCfg_t deviceCfg = {
         .deviceType = U_DEVICE_TYPE_SHORT_RANGE,
@@ -332,7 +477,7 @@ void main(void)
         .transportCfg = {
             .cfgUart = {
                 .uart = 2,     //as defined in board overlay file
-                .baudRate = 115200,
+                .baudRate = 115200, //NINA-W156 boot rate, then CONFIG_AQM_NINA_BAUD_RATE
                 .pinTxd = -1,  //defined in board overlay file
                 .pinRxd = -1,  //defined in board overlay file
                 .pinCts = -1,  //defined in board overlay file
@@ -349,88 +494,75 @@ void main(void)
         .pPassPhrase = WIFI_PASSWORD
     };
 
-    // MQTT Configuration parameters
-    const uMqttClientConnection_t mqttConnection = {
+    // MQTT Configuration parameters (used again at every reconnection)
+    static const uMqttClientConnection_t mqttConnection = {
+#if defined(CONFIG_AQM_UPLINK_MQTT_SN)
+            .pBrokerNameStr = MQTTSN_GATEWAY_NAME,
+            .mqttSn = true,
+#else
             .pBrokerNameStr = MQTT_BROKER_NAME,
             .localPort = MQTT_PORT,  
+#endif
             .pClientIdStr = MQTT_DEVICE_ID,
             .pUserNameStr = MQTT_USERNAME,
             .pPasswordStr = MQTT_PASSWORD
     };
 
-    // BLE scanning parameters
-    struct bt_le_scan_param scan_param = {
-            .type       = BT_HCI_LE_SCAN_ACTIVE,
-            .options    = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
-            .interval   = 0x0010,
-            .window     = 0x0010,
-    };
 	
 	printk("Air Quality Monitor Gateway Version: 1.0 \r\n\r\n");
 
-    // Initilize NINA-W156 Wi-Fi module hardware (set appropriate pins)    
-    nina15InitPower();
-    printk("NINA-W15 Powered on \r\n");
-    ninaNoraCommEnable();
-
-
-    // Set up Connection to Wi-Fi using ubxlib library (NINA-W156)
-    VERIFY(uPortInit() == 0, "uPortInit failed\n");
-    VERIFY(uDeviceInit() == 0, "uDeviceInit failed\n");
-    VERIFY(uDeviceOpen( &deviceCfg, &gDevHandle ) == 0, "uDeviceOpen failed\n");
-
-    uAtClientDebugSet(gDevHandle, false);
-
-    printk("Bring up Wi-Fi\n");
-    VERIFY(uNetworkInterfaceUp( gDevHandle, U_NETWORK_TYPE_WIFI, &wifiConfig ) == 0 , "Could not connect to network" );
-    printk("Wi-Fi connected\n");
-    
-    // Set up Connection to MQTT (Thingstream) using ubxlib library (NINA-W156)
-    printk("Setup up MQTT\n");
-    mqttClientCtx = pUMqttClientOpen( gDevHandle, NULL);
-    VERIFY( mqttClientCtx != NULL, "Could not open MQTT Client" );
-
-    printk("uMqttClientConnect...");
-    VERIFY( uMqttClientConnect( mqttClientCtx, &mqttConnection ) == 0, "uMqttClientConnect failed\n" );
-    printk("ok\n");
-
-    VERIFY( uMqttClientSetDisconnectCallback( mqttClientCtx, mqttDisconnectCb, (void *)mqttClientCtx) == 0, "Failed to set MQTT disconnection callback \r\n");
-
-	// Setup/Initialize BLE in NORA-B1
+	// Setup/Initialize BLE in NORA-B1. Scanning starts right away, the
+	// measurements are stored until the uplink is up
 	printk("Starting BLE\n");
 	VERIFY( bt_enable(NULL) == 0, "Bluetooth init failed\n" ); 
 	printk("Bluetooth initialized\n");
 
     // Start Scanning for BLE devices and setup callback for incoming advertising packets
-	VERIFY( bt_le_scan_start(&scan_param, scan_cb) == 0, "Scanning failed to start\n");
+	VERIFY( scannerStart() == 0, "Scanning failed to start\n");
     printk("\nWaiting for sensor advertisements\n");
 
-    do {
-        // if new measurement has been received, publish it to MQTT
-        if( gMeasReceived ){
-            // clear any previous message bytes
-            memset(gMessageToPublish,0,sizeof(gMessageToPublish));
-
-            // Prepare a JSON message containing the measurements
-            sprintf(gMessageToPublish,"{\"c02level\":%f, \"humidity\":%f, \"temperature\":%f}", gMeasurement.co2, gMeasurement.humitity, gMeasurement.temperature );
-            printf("Message to publish: %s\r\n", gMessageToPublish);
+    // Power up NINA-W156 and set up the connection to Wi-Fi and MQTT
+    // (Thingstream) using ubxlib library, in the background
+    linkInit( &deviceCfg, &wifiConfig, &mqttConnection );
+    linkStart();
 
-            // Publish the JSON message
-            if( uMqttClientPublish(mqttClientCtx, MQTT_TOPIC, gMessageToPublish, strlen(gMessageToPublish), 0, 0) == 0 ){
-                printk("Published\r\n\r\n");
-            }
-            else{
-                printk("Publish failed\r\n");
-            }
-
-            // Wait for next measurement
-            gMeasReceived = false;
-        }
-    } while(uMqttClientIsConnected(mqttClientCtx));
+#if defined(CONFIG_AQM_FLASH_LOG)
+    // The samples not published before a reboot are replayed first. Without
+    // the flash log the samples are only stored in RAM during outages.
+    if( flashLogInit() != 0 ){
+        printk("Flash log not available, storing in RAM only\n");
+    }
+#endif
+
+    // From now on the uplink thread publishes every measurement put in the
+    // ingest queue by the scan callback, reconnecting to the broker when the
+    // connection is lost. This thread just reports statistics.
+    uplinkStart();
+
+#if defined(CONFIG_AQM_TIME_SYNC)
+    // the epoch time of the samples, once the link is up
+    timeSyncStart();
+#endif
+
+#if defined(CONFIG_AQM_OWNERSHIP)
+    // agree with the other Gateways around on who publishes which broadcaster
+    ownershipStart();
+#endif
+
+#if defined(CONFIG_AQM_LAN_UDP)
+    // every new measurement to the local network too, as soon as Wi-Fi is up
+    lanUdpStart();
+#endif
+
+#if defined(CONFIG_AQM_TELEMETRY)
+    // the same metrics as a snapshot on the telemetry topic
+    telemetryStart();
+#endif
+
+    while( 1 ){
+        k_sleep(K_SECONDS(CONFIG_AQM_STATS_PRINT_PERIOD_S));
+        printStats();
+    }
 
-    // When disconnected from broker the application stops
-    printk("Application stoped\r\n");
-	bt_le_scan_stop();
-	
     return;
 }
@@ -21,7 +21,40 @@
 #include "nina_config.h"
 
 #include <zephyr.h>
+#include <device.h>
+#include <devicetree.h>
+#include <drivers/uart.h>
 #include <hal/nrf_gpio.h>
+#include <string.h>
+#include <errno.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** UART connected to NINA-W156 (see the board overlay) */
+#define NINA_UART_NODE          DT_NODELABEL(uart2)
+
+/** How often (msec) an AT command is sent while waiting for the module */
+#define NINA_AT_POLL_MS         100
+
+/** Longest line from the module kept while waiting (longer ones are not
+ * what we are waiting for) */
+#define NINA_LINE_MAX_LEN       16
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Sends a string to the module */
+static void ninaUartSend(const struct device *pUart, const char *pStr)
+{
+    while( *pStr != '\0' ){
+        uart_poll_out(pUart, (unsigned char)*pStr++);
+    }
+}
 
 
 
@@ -86,3 +119,68 @@ void nina15InitPower(void)
     // t_Startup time after release of reset UBX-18006647 - R10 (page 23)
     k_sleep(K_MSEC(2600));
 }
+
+
+int32_t nina15PowerUp(int32_t bootBaudRate, int32_t timeoutMs)
+{
+    const struct device *pUart = DEVICE_DT_GET(NINA_UART_NODE);
+    struct uart_config uartCfg;
+    char line[NINA_LINE_MAX_LEN + 1];
+    size_t lineLen = 0;
+    uint32_t startMs;
+    uint32_t lastAtMs;
+
+    nina15Enable();
+
+    // hold it in reset while it is powered, then release the reset
+    nina15ResetEnable();
+    k_sleep(K_MSEC(10));
+    nina15ResetDisable();
+
+    startMs = k_uptime_get_32();
+    lastAtMs = startMs;
+
+    if( !device_is_ready(pUart) ){
+        // cannot tell, wait for the t_Startup time after release of reset
+        // UBX-18006647 - R10 (page 23)
+        k_sleep(K_MSEC(2600));
+        return (int32_t)(k_uptime_get_32() - startMs);
+    }
+
+    // the UART may still be at the faster rate of a previous power up
+    if( ( uart_config_get(pUart, &uartCfg) == 0 ) &&
+        ( uartCfg.baudrate != (uint32_t)bootBaudRate ) ){
+        uartCfg.baudrate = (uint32_t)bootBaudRate;
+        uart_configure(pUart, &uartCfg);
+    }
+
+    // The module prints +STARTUP when it is ready. It may have been missed
+    // (e.g. if it did not need a reset), so it is also asked with AT
+    while( (int32_t)(k_uptime_get_32() - startMs) < timeoutMs ){
+        unsigned char c;
+
+        if( uart_poll_in(pUart, &c) != 0 ){
+            if( k_uptime_get_32() - lastAtMs >= NINA_AT_POLL_MS ){
+                lastAtMs = k_uptime_get_32();
+                ninaUartSend(pUart, "AT\r");
+            }
+            k_sleep(K_MSEC(1));
+            continue;
+        }
+
+        if( ( c != '\r' ) && ( c != '\n' ) ){
+            if( lineLen < NINA_LINE_MAX_LEN ){
+                line[lineLen++] = (char)c;
+            }
+            continue;
+        }
+
+        line[lineLen] = '\0';
+        lineLen = 0;
+        if( ( strcmp(line, "+STARTUP") == 0 ) || ( strcmp(line, "OK") == 0 ) ){
+            return (int32_t)(k_uptime_get_32() - startMs);
+        }
+    }
+
+    return -ETIMEDOUT;
+}
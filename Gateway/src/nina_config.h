@@ -22,6 +22,8 @@
  * module pins, power up of the module etc. It also defines NINA-W156 pins
  */
 
+#include <stdint.h>
+
 
 /* ----------------------------------------------------------------
  * NINA-W156 PIN DEFINITION
@@ -74,6 +76,19 @@ void ninaNoraCommDisable(void);
  */
 void nina15InitPower(void);
 
+/** Powers the NINA-W156 module and waits until it has started: polls its
+ *  UART for the +STARTUP message, or an OK to an AT command, instead of
+ *  waiting for the worst case start-up time. Should be called before
+ *  ubxlib opens the UART.
+ *
+ * @param bootBaudRate  UART rate of the module after start-up, the UART is
+ *                      switched to it before polling.
+ * @param timeoutMs     Maximum time (msec) to wait for the module.
+ * @return              the time (msec) the module took to start, or
+ *                      -ETIMEDOUT if it did not answer in time.
+ */
+int32_t nina15PowerUp(int32_t bootBaudRate, int32_t timeoutMs);
+
 
 
 #endif // NINAW156_CONFIG_H__
\ No newline at end of file
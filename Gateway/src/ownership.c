@@ -0,0 +1,482 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in ownership.h
+ */
+
+#include "ownership.h"
+
+#if defined(CONFIG_AQM_OWNERSHIP)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <string.h>
+#include <errno.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "ubxlib.h"
+#include "device_table.h"
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Beacon datagram: "AQO", version, address of the Gateway (6 bytes, as in
+ * bt_addr_t), number of entries, then per broadcaster its address type,
+ * address (6 bytes, as in bt_addr_t), smoothed RSSI and flags */
+#define OWNERSHIP_VERSION           1
+#define OWNERSHIP_HEADER_LEN        11
+#define OWNERSHIP_ENTRY_LEN         9
+#define OWNERSHIP_MAX_ENTRIES       56
+#define OWNERSHIP_MAX_LEN           ( OWNERSHIP_HEADER_LEN + OWNERSHIP_MAX_ENTRIES * OWNERSHIP_ENTRY_LEN )
+
+/** Flag of an entry: the Gateway owns the broadcaster */
+#define OWNERSHIP_FLAG_OWNER        0x01
+
+/** Length of a Gateway address */
+#define OWNERSHIP_ID_LEN            6
+
+/** How often (msec) Wi-Fi is checked while it is down */
+#define OWNERSHIP_WAIT_LINK_MS      1000
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** A broadcaster as listed by a peer */
+typedef struct{
+    uint32_t ms;            /**< Uptime (msec) of the last beacon listing it, zero if never */
+    int8_t rssi;            /**< Its smoothed RSSI at the peer */
+    bool owner;             /**< The peer owns it */
+}peerDevice_t;
+
+/** Another Gateway */
+typedef struct{
+    uint8_t id[OWNERSHIP_ID_LEN];   /**< Its Bluetooth address */
+    uint32_t lastMs;                /**< Uptime (msec) of its last beacon, zero if never */
+    peerDevice_t devices[CONFIG_AQM_MAX_DEVICES];
+}peer_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gOwnershipStack, CONFIG_AQM_OWNERSHIP_THREAD_STACK_SIZE);
+static struct k_thread gOwnershipThread;
+
+/** Given by the socket when a datagram arrives */
+static K_SEM_DEFINE(gDataSem, 0, 1);
+
+static const uint8_t gMagic[3] = { 'A', 'Q', 'O' };
+
+/** Address of this Gateway, identifies it in the beacons */
+static uint8_t gId[OWNERSHIP_ID_LEN];
+
+/** Destination of the beacons, the port is also the one they are received on */
+static uSockAddress_t gAddress;
+
+/** The socket, negative while not open. Only used under the link lock */
+static int32_t gSock = -1;
+
+/** The peers, only written by the ownership thread */
+static peer_t gPeers[CONFIG_AQM_OWNERSHIP_MAX_PEERS];
+
+/** Smoothed RSSI (1/16 dBm) of every broadcaster, zero until its first
+ * measurement (an RSSI is negative), and if this Gateway owns it. Only
+ * written by the uplink thread */
+static int16_t gRssiQ4[CONFIG_AQM_MAX_DEVICES];
+static bool gOwner[CONFIG_AQM_MAX_DEVICES];
+
+/** Only written by the uplink thread, too wide for an atomic_t */
+static uint64_t gUniquePermille;
+
+static atomic_t gReceived = ATOMIC_INIT(0);
+static atomic_t gPublished = ATOMIC_INIT(0);
+static atomic_t gYielded = ATOMIC_INIT(0);
+static atomic_t gDuplicates = ATOMIC_INIT(0);
+static atomic_t gTakeovers = ATOMIC_INIT(0);
+static atomic_t gHandovers = ATOMIC_INIT(0);
+static atomic_t gBeaconsSent = ATOMIC_INIT(0);
+static atomic_t gBeaconsReceived = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+static bool ownershipIsFresh(uint32_t ms, uint32_t nowMs)
+{
+    return ( ms != 0 ) && ( nowMs - ms < CONFIG_AQM_OWNERSHIP_TAKEOVER_MS );
+}
+
+
+/** Checks if Gateway a receives a broadcaster better than Gateway b, the
+ * lowest address winning a tie so that all the Gateways agree */
+static bool ownershipIsBetter(int rssiA, const uint8_t *pIdA, int rssiB, const uint8_t *pIdB)
+{
+    return ( rssiA > rssiB ) ||
+           ( ( rssiA == rssiB ) && ( memcmp(pIdA, pIdB, OWNERSHIP_ID_LEN) < 0 ) );
+}
+
+
+/** Finds the peer with an address, or takes a slot for it (a free one, or
+ * the one of a peer gone silent) */
+static peer_t *ownershipPeer(const uint8_t *pId, uint32_t nowMs)
+{
+    peer_t *pFree = NULL;
+
+    for( int i = 0; i < CONFIG_AQM_OWNERSHIP_MAX_PEERS; i++ ){
+        peer_t *pPeer = &gPeers[i];
+
+        if( ( pPeer->lastMs != 0 ) && ( memcmp(pPeer->id, pId, OWNERSHIP_ID_LEN) == 0 ) ){
+            return pPeer;
+        }
+        if( ( pFree == NULL ) && !ownershipIsFresh(pPeer->lastMs, nowMs) ){
+            pFree = pPeer;
+        }
+    }
+
+    if( pFree != NULL ){
+        memset(pFree->devices, 0, sizeof(pFree->devices));
+        memcpy(pFree->id, pId, OWNERSHIP_ID_LEN);
+    }
+
+    return pFree;
+}
+
+
+/** Takes the entries of a beacon received */
+static void ownershipParse(const uint8_t *pBuf, int32_t len, uint32_t nowMs)
+{
+    const uint8_t *pId = &pBuf[4];
+    peer_t *pPeer;
+    int count;
+
+    if( ( len < OWNERSHIP_HEADER_LEN ) || ( memcmp(pBuf, gMagic, sizeof(gMagic)) != 0 ) ||
+        ( pBuf[3] != OWNERSHIP_VERSION ) ){
+        return;
+    }
+
+    // a broadcast comes back to its sender
+    if( memcmp(pId, gId, OWNERSHIP_ID_LEN) == 0 ){
+        return;
+    }
+
+    count = pBuf[10];
+    if( len < OWNERSHIP_HEADER_LEN + count * OWNERSHIP_ENTRY_LEN ){
+        return;
+    }
+
+    pPeer = ownershipPeer(pId, nowMs);
+    if( pPeer == NULL ){
+        printk("Too many Gateways, beacon ignored\r\n");
+        return;
+    }
+    pPeer->lastMs = nowMs;
+    atomic_inc(&gBeaconsReceived);
+
+    for( int i = 0; i < count; i++ ){
+        const uint8_t *pEntry = &pBuf[OWNERSHIP_HEADER_LEN + i * OWNERSHIP_ENTRY_LEN];
+        bt_addr_le_t addr;
+        int index;
+
+        addr.type = pEntry[0];
+        memcpy(addr.a.val, &pEntry[1], sizeof(addr.a.val));
+
+        // only the broadcasters this Gateway hears too matter
+        index = deviceTableFind(&addr);
+        if( index < 0 ){
+            continue;
+        }
+
+        pPeer->devices[index].rssi = (int8_t)pEntry[7];
+        pPeer->devices[index].owner = ( pEntry[8] & OWNERSHIP_FLAG_OWNER ) != 0;
+        pPeer->devices[index].ms = nowMs;
+    }
+}
+
+
+/** Sends the beacon: the broadcasters heard in the last takeover time, in
+ * as many datagrams as needed */
+static int ownershipSendBeacon(uint32_t nowMs)
+{
+    static uint8_t beacon[OWNERSHIP_MAX_LEN];
+    int deviceCount = (int)deviceTableCount();
+    int count = 0;
+
+    memcpy(beacon, gMagic, sizeof(gMagic));
+    beacon[3] = OWNERSHIP_VERSION;
+    memcpy(&beacon[4], gId, OWNERSHIP_ID_LEN);
+
+    for( int i = 0; i <= deviceCount; i++ ){
+        int32_t len;
+
+        if( i < deviceCount ){
+            const deviceEntry_t *pDevice = deviceTableGet(i);
+            uint8_t *pEntry = &beacon[OWNERSHIP_HEADER_LEN + count * OWNERSHIP_ENTRY_LEN];
+
+            if( ( gRssiQ4[i] == 0 ) || !ownershipIsFresh(pDevice->lastSeenMs, nowMs) ){
+                continue;
+            }
+
+            pEntry[0] = pDevice->addr.type;
+            memcpy(&pEntry[1], pDevice->addr.a.val, sizeof(pDevice->addr.a.val));
+            pEntry[7] = (uint8_t)(int8_t)( gRssiQ4[i] / 16 );
+            pEntry[8] = gOwner[i] ? OWNERSHIP_FLAG_OWNER : 0;
+            count++;
+
+            if( count < OWNERSHIP_MAX_ENTRIES ){
+                continue;
+            }
+        }
+
+        // the last datagram is sent even if empty: the peers know this
+        // Gateway is there
+        beacon[10] = (uint8_t)count;
+        len = OWNERSHIP_HEADER_LEN + count * OWNERSHIP_ENTRY_LEN;
+        if( uSockSendTo(gSock, &gAddress, beacon, len) != len ){
+            return -EIO;
+        }
+        atomic_inc(&gBeaconsSent);
+        count = 0;
+    }
+
+    return 0;
+}
+
+
+/** Called by ubxlib when a datagram arrives */
+static void ownershipDataCb(void *pParameter)
+{
+    k_sem_give(&gDataSem);
+}
+
+
+static int ownershipOpen(uDeviceHandle_t devHandle)
+{
+    uSockAddress_t local = { .ipAddress.type = U_SOCK_ADDRESS_TYPE_V4, .port = gAddress.port };
+
+    gSock = uSockCreate(devHandle, U_SOCK_TYPE_DGRAM, U_SOCK_PROTOCOL_UDP);
+    if( gSock < 0 ){
+        return (int)gSock;
+    }
+
+    if( uSockBind(gSock, &local) != 0 ){
+        uSockClose(gSock);
+        gSock = -1;
+        return -EIO;
+    }
+
+    // the beacons are read when the socket says they are there
+    uSockBlockingSet(gSock, false);
+    uSockRegisterCallbackData(gSock, ownershipDataCb, NULL);
+
+    return 0;
+}
+
+
+/** Closes the socket, also called by the link (locked) before it is lost */
+static void ownershipClose(void)
+{
+    if( gSock >= 0 ){
+        uSockClose(gSock);
+        gSock = -1;
+    }
+}
+
+
+static void ownershipThread(void *p1, void *p2, void *p3)
+{
+    static uint8_t buf[OWNERSHIP_MAX_LEN];
+    uint32_t nextBeaconMs = k_uptime_get_32();
+
+    for( ;; ){
+        uDeviceHandle_t devHandle;
+        uint32_t nowMs;
+        int32_t len;
+        int err;
+
+        // the socket is only used under the link lock, the link closes it
+        // before it is lost
+        devHandle = linkSocketLock();
+        if( devHandle == NULL ){
+            k_sleep(K_MSEC(OWNERSHIP_WAIT_LINK_MS));
+            continue;
+        }
+
+        if( gSock < 0 ){
+            err = ownershipOpen(devHandle);
+            if( err ){
+                linkSocketUnlock();
+                printk("Ownership socket could not be opened (err %d)\r\n", err);
+                k_sleep(K_MSEC(OWNERSHIP_WAIT_LINK_MS));
+                continue;
+            }
+        }
+
+        do{
+            len = uSockReceiveFrom(gSock, NULL, buf, sizeof(buf));
+            if( len > 0 ){
+                ownershipParse(buf, len, k_uptime_get_32());
+            }
+        }while( len > 0 );
+
+        nowMs = k_uptime_get_32();
+        if( (int32_t)( nextBeaconMs - nowMs ) <= 0 ){
+            err = ownershipSendBeacon(nowMs);
+            if( err ){
+                printk("Ownership beacon could not be sent (err %d)\r\n", err);
+                ownershipClose();
+            }
+            nextBeaconMs = nowMs + CONFIG_AQM_OWNERSHIP_BEACON_MS;
+        }
+
+        linkSocketUnlock();
+
+        // until a beacon arrives or the next one is due
+        nowMs = k_uptime_get_32();
+        k_sem_take(&gDataSem, K_MSEC(MAX((int32_t)( nextBeaconMs - nowMs ), 0)));
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void ownershipStart(void)
+{
+    bt_addr_le_t addr;
+    size_t count = 1;
+
+    bt_id_get(&addr, &count);
+    memcpy(gId, addr.a.val, OWNERSHIP_ID_LEN);
+
+    if( uSockStringToAddress(CONFIG_AQM_OWNERSHIP_ADDRESS, &gAddress) != 0 ){
+        printk("Invalid ownership address %s, publishing every broadcaster\r\n",
+               CONFIG_AQM_OWNERSHIP_ADDRESS);
+        return;
+    }
+
+    linkAddSocketCloseCallback(ownershipClose);
+
+    // below the uplink, like the other background services
+    k_thread_create(&gOwnershipThread, gOwnershipStack,
+                    K_THREAD_STACK_SIZEOF(gOwnershipStack),
+                    ownershipThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY + 1), 0, K_NO_WAIT);
+    k_thread_name_set(&gOwnershipThread, "ownership");
+}
+
+
+bool ownershipCheck(const aqmSample_t *pSample)
+{
+    int index = pSample->deviceIndex;
+    uint32_t nowMs = k_uptime_get_32();
+    const peer_t *pOwner = NULL;
+    int ownerRssi = 0;
+    int hearers = 1;
+    bool owner;
+    int rssi;
+
+    // smoothed, so that a single weak advertisement does not hand it over
+    if( gRssiQ4[index] == 0 ){
+        gRssiQ4[index] = pSample->rssi * 16;
+    }
+    else{
+        gRssiQ4[index] += ( pSample->rssi * 16 - gRssiQ4[index] ) / 4;
+    }
+    rssi = gRssiQ4[index] / 16;
+
+    // the best peer owning the broadcaster, if any
+    for( int i = 0; i < CONFIG_AQM_OWNERSHIP_MAX_PEERS; i++ ){
+        const peer_t *pPeer = &gPeers[i];
+        const peerDevice_t *pDevice = &pPeer->devices[index];
+
+        if( !ownershipIsFresh(pPeer->lastMs, nowMs) || !ownershipIsFresh(pDevice->ms, nowMs) ){
+            continue;
+        }
+
+        hearers++;
+        if( pDevice->owner &&
+            ( ( pOwner == NULL ) || ownershipIsBetter(pDevice->rssi, pPeer->id, ownerRssi, pOwner->id) ) ){
+            pOwner = pPeer;
+            ownerRssi = pDevice->rssi;
+        }
+    }
+
+    if( pOwner == NULL ){
+        owner = true;
+    }
+    else if( gOwner[index] ){
+        // only to an owner receiving it better: it already publishes it
+        owner = !ownershipIsBetter(ownerRssi, pOwner->id, rssi, gId);
+    }
+    else{
+        owner = ( rssi > ownerRssi + CONFIG_AQM_OWNERSHIP_HYSTERESIS_DB );
+    }
+
+    if( owner != gOwner[index] ){
+        atomic_inc(owner ? &gTakeovers : &gHandovers);
+        gOwner[index] = owner;
+    }
+
+    atomic_inc(&gReceived);
+    gUniquePermille += 1000 / hearers;
+    if( owner ){
+        atomic_inc(&gPublished);
+        if( pOwner != NULL ){
+            atomic_inc(&gDuplicates);
+        }
+    }
+    else{
+        atomic_inc(&gYielded);
+    }
+
+    return owner;
+}
+
+
+void ownershipGetStats(ownershipStats_t *pStats)
+{
+    uint32_t nowMs = k_uptime_get_32();
+
+    pStats->received = (uint32_t)atomic_get(&gReceived);
+    pStats->published = (uint32_t)atomic_get(&gPublished);
+    pStats->yielded = (uint32_t)atomic_get(&gYielded);
+    pStats->uniquePermille = gUniquePermille;
+    pStats->duplicates = (uint32_t)atomic_get(&gDuplicates);
+    pStats->takeovers = (uint32_t)atomic_get(&gTakeovers);
+    pStats->handovers = (uint32_t)atomic_get(&gHandovers);
+    pStats->beaconsSent = (uint32_t)atomic_get(&gBeaconsSent);
+    pStats->beaconsReceived = (uint32_t)atomic_get(&gBeaconsReceived);
+
+    pStats->peers = 0;
+    for( int i = 0; i < CONFIG_AQM_OWNERSHIP_MAX_PEERS; i++ ){
+        if( ownershipIsFresh(gPeers[i].lastMs, nowMs) ){
+            pStats->peers++;
+        }
+    }
+}
+
+#endif // CONFIG_AQM_OWNERSHIP
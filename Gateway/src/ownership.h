@@ -0,0 +1,98 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OWNERSHIP_H__
+#define  OWNERSHIP_H__
+
+/** @file
+ * @brief The ownership lets several Gateways covering the same broadcasters
+ * publish every measurement only once (CONFIG_AQM_OWNERSHIP): every
+ * broadcaster is owned by the Gateway receiving it best, only the owner
+ * publishes its measurements.
+ *
+ * Every Gateway sends a beacon every CONFIG_AQM_OWNERSHIP_BEACON_MS, in UDP
+ * datagrams to CONFIG_AQM_OWNERSHIP_ADDRESS (the local network broadcast
+ * address by default), over a socket of NINA-W156. It lists the
+ * broadcasters the Gateway hears, with their smoothed RSSI and whether the
+ * Gateway owns them. From the beacons of the other Gateways (its peers)
+ * every Gateway decides, at every measurement:
+ *
+ * - with no peer owning the broadcaster, it takes it over;
+ * - a peer owning it is only taken over with an RSSI better by
+ *   CONFIG_AQM_OWNERSHIP_HYSTERESIS_DB, so the ownership does not flap;
+ * - an owner only hands over to a peer which owns the broadcaster too and
+ *   receives it better (the lowest Gateway address on a tie), so there is
+ *   always an owner: two owners for a beacon period at worst, never none.
+ *
+ * A peer whose beacon lists a broadcaster no more for
+ * CONFIG_AQM_OWNERSHIP_TAKEOVER_MS is ignored for it: the other Gateways
+ * take it over.
+ *
+ * ownershipCheck() is only called by the uplink thread, the beacons are
+ * sent and received by a thread of their own. The per-device state is
+ * word-sized values with a single writer each, the statistics can be read
+ * by any thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the ownership */
+typedef struct{
+    uint32_t received;          /**< Measurements received */
+    uint32_t published;         /**< Measurements published (owned) */
+    uint32_t yielded;           /**< Measurements left to the peer owning the broadcaster */
+    uint64_t uniquePermille;    /**< Sum, over the measurements received, of 1000 / Gateways hearing the broadcaster */
+    uint32_t duplicates;        /**< Measurements published while a peer owned the broadcaster too */
+    uint32_t takeovers;         /**< Broadcasters taken over */
+    uint32_t handovers;         /**< Broadcasters handed over to a peer */
+    uint32_t beaconsSent;       /**< Beacon datagrams sent */
+    uint32_t beaconsReceived;   /**< Beacon datagrams received from peers */
+    uint32_t peers;             /**< Peers heard in the last takeover time */
+}ownershipStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the thread sending and receiving the beacons. Bluetooth should be
+ *  enabled and the link (see link.h) initialized.
+ */
+void ownershipStart(void);
+
+/** Decides if this Gateway owns the broadcaster of a new measurement.
+ *
+ * @param pSample  The sample.
+ * @return         true if the sample should be published.
+ */
+bool ownershipCheck(const aqmSample_t *pSample);
+
+/** Gets a snapshot of the ownership statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void ownershipGetStats(ownershipStats_t *pStats);
+
+
+#endif // OWNERSHIP_H__
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in scan_schedule.h
+ */
+
+#include "scan_schedule.h"
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <errno.h>
+
+#include "device_table.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Learned periods outside these limits (msec) are ignored */
+#define SCHEDULE_MIN_PERIOD_MS      500
+#define SCHEDULE_MAX_PERIOD_MS      120000
+
+/** A period is only learned from bursts at most this many message ids apart */
+#define SCHEDULE_MAX_ID_GAP         4
+
+/** Broadcasters not seen for this long are absent: not waited for */
+#define SCHEDULE_ABSENT_MS          (CONFIG_AQM_SCAN_DEVICE_TIMEOUT_S * 1000U)
+
+/** Bursts predicted within this span (msec) share one scan window */
+#define SCHEDULE_MERGE_SPAN_MS      (2 * CONFIG_AQM_SCAN_GUARD_MS + CONFIG_AQM_SCAN_CATCH_MS)
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Schedule of a broadcaster */
+typedef struct{
+    uint32_t burstStartMs;  /**< Uptime the current message id was first seen */
+    uint32_t burstMsgId;    /**< The current message id */
+    uint32_t periodMs;      /**< Learned period, 0 when not learned */
+    uint32_t nextStartMs;   /**< Predicted start of the next burst (planning only) */
+    uint8_t misses;         /**< Windows missed in a row */
+    bool seen;              /**< At least one burst seen */
+    bool inWindow;          /**< Expected in the current window */
+}deviceSchedule_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static deviceSchedule_t gSchedule[CONFIG_AQM_MAX_DEVICES];
+
+/** Bit n set: device n is expected in the current window. Cleared by the
+ * scan callback when the burst arrives */
+static ATOMIC_DEFINE(gExpected, CONFIG_AQM_MAX_DEVICES);
+
+/** Number of devices still expected in the current window */
+static atomic_t gPending = ATOMIC_INIT(0);
+
+static scanScheduleStats_t gStats;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+bool scanScheduleObserve(int deviceIndex, uint32_t nowMs, uint32_t messageId)
+{
+    deviceSchedule_t *pSched = &gSchedule[deviceIndex];
+
+    // learn the period from the previous burst (the message id may have
+    // advanced by more than one if bursts were missed)
+    if( pSched->seen && ( messageId > pSched->burstMsgId ) &&
+        ( messageId - pSched->burstMsgId <= SCHEDULE_MAX_ID_GAP ) ){
+        uint32_t sampleMs = (nowMs - pSched->burstStartMs) / (messageId - pSched->burstMsgId);
+
+        if( ( sampleMs >= SCHEDULE_MIN_PERIOD_MS ) && ( sampleMs <= SCHEDULE_MAX_PERIOD_MS ) ){
+            // smooth the jitter of the arrival times
+            pSched->periodMs = ( pSched->periodMs == 0 ) ?
+                               sampleMs : ( 3 * pSched->periodMs + sampleMs ) / 4;
+        }
+    }
+
+    pSched->burstStartMs = nowMs;
+    pSched->burstMsgId = messageId;
+    pSched->misses = 0;
+    pSched->seen = true;
+
+    if( atomic_test_and_clear_bit(gExpected, deviceIndex) ){
+        // atomic_dec returns the previous value
+        return atomic_dec(&gPending) == 1;
+    }
+
+    return false;
+}
+
+
+int scanSchedulePlan(uint32_t nowMs, uint32_t *pOpenMs, uint32_t *pCloseMs)
+{
+    int count = (int)deviceTableCount();
+    uint32_t firstDelta = UINT32_MAX;
+    uint32_t lastStartMs;
+    int expected = 0;
+
+    // predict the next burst of every present broadcaster
+    for( int i = 0; i < count; i++ ){
+        deviceSchedule_t *pSched = &gSchedule[i];
+
+        if( nowMs - deviceTableGet(i)->lastSeenMs > SCHEDULE_ABSENT_MS ){
+            pSched->nextStartMs = 0;
+            continue;
+        }
+
+        if( pSched->periodMs == 0 ){
+            // cannot predict this one, scan continuously to learn it
+            return -EAGAIN;
+        }
+
+        uint32_t elapsed = nowMs - pSched->burstStartMs;
+        uint32_t delta = pSched->periodMs - (elapsed % pSched->periodMs);
+
+        pSched->nextStartMs = nowMs + delta;
+        if( delta < firstDelta ){
+            firstDelta = delta;
+        }
+    }
+
+    if( firstDelta == UINT32_MAX ){
+        return 0;
+    }
+
+    // every burst predicted close to the first one shares its window
+    lastStartMs = nowMs + firstDelta;
+    for( int i = 0; i < count; i++ ){
+        deviceSchedule_t *pSched = &gSchedule[i];
+
+        if( ( pSched->nextStartMs != 0 ) &&
+            ( pSched->nextStartMs - nowMs <= firstDelta + SCHEDULE_MERGE_SPAN_MS ) ){
+            if( pSched->nextStartMs - nowMs > lastStartMs - nowMs ){
+                lastStartMs = pSched->nextStartMs;
+            }
+            pSched->inWindow = true;
+            atomic_set_bit(gExpected, i);
+            expected++;
+        }
+    }
+
+    atomic_set(&gPending, expected);
+
+    *pOpenMs = ( firstDelta > CONFIG_AQM_SCAN_GUARD_MS ) ?
+               nowMs + firstDelta - CONFIG_AQM_SCAN_GUARD_MS : nowMs;
+    *pCloseMs = lastStartMs + CONFIG_AQM_SCAN_GUARD_MS + CONFIG_AQM_SCAN_CATCH_MS;
+
+    return expected;
+}
+
+
+void scanScheduleWindowClosed(bool early)
+{
+    int count = (int)deviceTableCount();
+
+    gStats.windows++;
+    if( early ){
+        gStats.earlyClosed++;
+    }
+
+    for( int i = 0; i < count; i++ ){
+        if( !gSchedule[i].inWindow ){
+            continue;
+        }
+        gStats.expected++;
+
+        if( atomic_test_and_clear_bit(gExpected, i) ){
+            gStats.missed++;
+            gSchedule[i].misses++;
+
+            // lost track of this broadcaster, learn its period again
+            if( gSchedule[i].misses >= CONFIG_AQM_SCAN_MAX_MISSES ){
+                gSchedule[i].periodMs = 0;
+                gSchedule[i].misses = 0;
+                gStats.resyncs++;
+            }
+        }
+        gSchedule[i].inWindow = false;
+    }
+
+    atomic_set(&gPending, 0);
+}
+
+
+void scanScheduleCancel(void)
+{
+    int count = (int)deviceTableCount();
+
+    for( int i = 0; i < count; i++ ){
+        atomic_clear_bit(gExpected, i);
+        gSchedule[i].inWindow = false;
+    }
+
+    atomic_set(&gPending, 0);
+}
+
+
+void scanScheduleGetStats(scanScheduleStats_t *pStats)
+{
+    *pStats = gStats;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCAN_SCHEDULE_H__
+#define  SCAN_SCHEDULE_H__
+
+/** @file
+ * @brief The scan schedule learns when each broadcaster advertises and plans
+ * scan windows around the predicted advertising bursts.
+ *
+ * A broadcaster advertises each measurement for a short time (a burst) and
+ * then stays silent until the next measurement. The time a new message id is
+ * first seen is taken as the start of its burst; the period is learned from
+ * the distance between consecutive bursts. Once every present broadcaster has
+ * a learned period, the scanner only needs to scan from a guard time before
+ * the next predicted burst until the burst has been received.
+ *
+ * A broadcaster missing CONFIG_AQM_SCAN_MAX_MISSES windows in a row loses its
+ * learned period: the scanner then scans continuously until it is learned
+ * again (resync).
+ *
+ * Per-device state is kept in arrays indexed by the device table index.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the scan schedule */
+typedef struct{
+    uint32_t windows;       /**< Scan windows opened */
+    uint32_t earlyClosed;   /**< Windows closed early, all expected bursts received */
+    uint32_t expected;      /**< Bursts expected in the windows (all devices) */
+    uint32_t missed;        /**< Expected bursts not received in their window */
+    uint32_t resyncs;       /**< Learned periods dropped after too many misses */
+}scanScheduleStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Records a new (in order) measurement of a broadcaster. Called from the
+ *  scan callback.
+ *
+ * @param deviceIndex  Index of the broadcaster in the device table.
+ * @param nowMs        Uptime (msec) the measurement was received.
+ * @param messageId    The message id of the measurement.
+ * @return             true if this was the last burst expected in the
+ *                     current scan window (the window can be closed).
+ */
+bool scanScheduleObserve(int deviceIndex, uint32_t nowMs, uint32_t messageId);
+
+/** Plans the next scan window and marks the broadcasters expected in it.
+ *
+ * @param nowMs     Current uptime (msec).
+ * @param pOpenMs   Set to the uptime when the window should open.
+ * @param pCloseMs  Set to the uptime when the window should close at the latest.
+ * @return          the number of broadcasters expected in the window, zero if
+ *                  there is no broadcaster to wait for, or -EAGAIN if some
+ *                  broadcaster has no learned period yet (scan continuously).
+ */
+int scanSchedulePlan(uint32_t nowMs, uint32_t *pOpenMs, uint32_t *pCloseMs);
+
+/** Closes the current window: the broadcasters which were expected but not
+ *  received are counted as missed. Scanning should be stopped.
+ *
+ * @param early  true if the window was closed early (all bursts received).
+ */
+void scanScheduleWindowClosed(bool early);
+
+/** Cancels a planned window which was never opened.
+ */
+void scanScheduleCancel(void);
+
+/** Gets a snapshot of the schedule statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void scanScheduleGetStats(scanScheduleStats_t *pStats);
+
+
+#endif // SCAN_SCHEDULE_H__
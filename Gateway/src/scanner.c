@@ -0,0 +1,596 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in scanner.h
+ */
+
+#include "scanner.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+#include "aqm_sample.h"
+#include "device_table.h"
+#include "ingest_queue.h"
+#include "lan_udp.h"
+#include "scan_schedule.h"
+#include "time_sync.h"
+#include "trace.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+// The name of the broadcaster (under which name the broadcaster advertises)
+#define BROADCASTER_NAME    "ZephyrAQM"
+#define BROADCASTER_NAME_LEN ( sizeof( BROADCASTER_NAME ) - 1 )
+
+/** Delay (msec) before retrying when scanning could not be (re)started */
+#define SCAN_RETRY_DELAY_MS     1000
+
+/** While some broadcaster has no learned schedule, the scan windows are
+ * planned again with this period (msec) */
+#define SCAN_REPLAN_MS          2000
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Scanning modes */
+typedef enum{
+    SCAN_MODE_STOPPED = 0,          /**< Not scanning */
+    SCAN_MODE_DISCOVERY,            /**< Any device is reported, new broadcasters are found */
+    SCAN_MODE_CONTINUOUS,           /**< Tracking known broadcasters, scanning all the time */
+    SCAN_MODE_IDLE,                 /**< Tracking known broadcasters, waiting for the next window */
+    SCAN_MODE_WINDOW                /**< Tracking known broadcasters, scanning around predicted bursts */
+}scanMode_t;
+
+/** What the parsing of a single advertising report found */
+typedef struct{
+    bool checkName;                 /**< Look for the broadcaster name (unknown device) */
+    bool nameFound;                 /**< The broadcaster name is in the report */
+    bool tagFound;                  /**< The AQM header is in the manufacturer data */
+    const uint8_t *pMfgData;        /**< Manufacturer specific data, if any */
+    uint8_t mfgDataLen;             /**< Length of pMfgData */
+}advParseResult_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static atomic_t gAdvSeen = ATOMIC_INIT(0);
+static atomic_t gAdvMatched = ATOMIC_INIT(0);
+static atomic_t gTableFull = ATOMIC_INIT(0);
+static atomic_t gDuplicates = ATOMIC_INIT(0);
+static atomic_t gReordered = ATOMIC_INIT(0);
+static atomic_t gStale = ATOMIC_INIT(0);
+static atomic_t gReboots = ATOMIC_INIT(0);
+static atomic_t gDiscoveries = ATOMIC_INIT(0);
+static atomic_t gAcceptListLen = ATOMIC_INIT(0);
+static atomic_t gFilteredMs = ATOMIC_INIT(0);
+static atomic_t gScanOnMs = ATOMIC_INIT(0);
+
+/** Current scanning mode. Only changed by the scan work handler (and
+ * read by the scan callback) */
+static scanMode_t gScanMode = SCAN_MODE_STOPPED;
+
+/** Uptime (msec) when scanning was started, and when the radio was last
+ * turned on for scanning */
+static uint32_t gScanStartMs;
+static uint32_t gScanOnStartMs;
+
+/** Uptime (msec) of the next discovery scan */
+static uint32_t gNextDiscoveryMs;
+
+/** Uptime (msec) when the planned scan window closes */
+static uint32_t gWindowCloseMs;
+
+/** Switches between the scanning modes (runs in the system workqueue) */
+static void scanWorkHandler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(gScanWork, scanWorkHandler);
+
+#if defined(CONFIG_AQM_TRACE)
+/** Cycle counter when the scan callback was entered (Bluetooth RX thread only) */
+static uint32_t gCallbackCycles;
+#endif
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION DECLARATION
+ * -------------------------------------------------------------- */
+
+/** The scan callback to be executed when a new device is found be the BLE scanner
+ *
+ * @param addr       See bt_le_scan_cb_t description.
+ * @param rssi       See bt_le_scan_cb_t description.
+ * @param adv_type   See bt_le_scan_cb_t description.
+ * @param buf        See bt_le_scan_cb_t description.
+ */
+static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+		    struct net_buf_simple *buf);
+
+
+/** To be used as a parameter of bt_data_parse() within the scan callback.
+ *  Checks every AD structure of the report: if it is the name requested by
+ *  the BROADCASTER_NAME definition, or if it contains measurement data
+ *  (with or without the AQM header in front).
+ *
+ *  @param data       see bt_data_parse() description.
+ *  @param user_data  pointer to an advParseResult_t, filled with what was found.
+ *  @return           true, to continue parsing the rest of the report.
+ */
+static bool adv_parse(struct bt_data *data, void *user_data);
+
+
+/** Handles the measurement data of a known broadcaster. If it is a NEW
+ *  measurement (never received before, see dedup_window.h) it is put in
+ *  the ingest queue for the uplink thread to publish it.
+ *
+ *  @param deviceIndex  Index of the broadcaster in the device table.
+ *  @param pData        The manufacturer specific data of the advertisement.
+ *  @param len          Length of pData.
+ */
+static void adv_data_found(int deviceIndex, const uint8_t *pData, uint8_t len);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+static bool adv_parse(struct bt_data *data, void *user_data)
+{
+    advParseResult_t *pResult = user_data;
+
+    switch( data->type ){
+        // 0x09 is for: Complete Local Name
+        case BT_DATA_NAME_COMPLETE:
+            if( pResult->checkName &&
+                ( data->data_len == BROADCASTER_NAME_LEN ) &&
+                ( memcmp( data->data, BROADCASTER_NAME, BROADCASTER_NAME_LEN ) == 0 ) ){
+                pResult->nameFound = true;
+            }
+            break;
+
+        // 0xFF contains measurement data, after the AQM header if the
+        // broadcaster identifies itself in the primary advertisement
+        case BT_DATA_MANUFACTURER_DATA:
+            if( ( data->data_len >= AQM_ADV_HEADER_LEN ) &&
+                ( sys_get_le16( data->data ) == AQM_COMPANY_ID ) &&
+                ( data->data[2] == AQM_ADV_TAG_0 ) &&
+                ( data->data[3] == AQM_ADV_TAG_1 ) ){
+                pResult->tagFound = true;
+                pResult->pMfgData = data->data + AQM_ADV_HEADER_LEN;
+                pResult->mfgDataLen = data->data_len - AQM_ADV_HEADER_LEN;
+            }
+            else{
+                pResult->pMfgData = data->data;
+                pResult->mfgDataLen = data->data_len;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return true;
+}
+
+
+static void adv_data_found(int deviceIndex, const uint8_t *pData, uint8_t len)
+{
+    deviceEntry_t *pDevice = deviceTableGet(deviceIndex);
+    aqmSample_t sample;
+    dedupResult_t result;
+
+    // copy the advertisement data to the measurement structure. For this to
+    // work, aqmMeasurement_t should be defined exactly the same in the sensor
+    // broadcaster and the receiver/Gateway. The same MCU is also used in both sides,
+    // so its safe to use for this example.
+    if( len >= sizeof(sample.meas) ){
+        memcpy( &sample.meas, pData, sizeof(sample.meas) );
+    }
+    else if( len >= AQM_MEASUREMENT_EPOCH_LEN ){
+        // older broadcaster, without timing
+        memcpy( &sample.meas, pData, AQM_MEASUREMENT_EPOCH_LEN );
+        sample.meas.age_ms = AQM_TIME_UNKNOWN;
+        sample.meas.fetch_ms = AQM_TIME_UNKNOWN;
+    }
+    else if( len >= AQM_MEASUREMENT_LEGACY_LEN ){
+        // older broadcaster, without boot epoch
+        memcpy( &sample.meas, pData, AQM_MEASUREMENT_LEGACY_LEN );
+        sample.meas.boot_epoch = DEDUP_BOOT_EPOCH_NONE;
+        sample.meas.age_ms = AQM_TIME_UNKNOWN;
+        sample.meas.fetch_ms = AQM_TIME_UNKNOWN;
+    }
+    else{
+        return;
+    }
+
+    // Each measurement is broadcasted many times and advertisements may arrive
+    // reordered, so check the id against the window of ids recently received
+    // from this device. Only ids never received before are forwarded.
+    result = dedupWindowCheck(&pDevice->window, sample.meas.boot_epoch, sample.meas.message_id);
+    switch( result ){
+        case DEDUP_DUPLICATE:
+            pDevice->duplicates++;
+            atomic_inc(&gDuplicates);
+            return;
+
+        case DEDUP_STALE:
+            pDevice->stale++;
+            atomic_inc(&gStale);
+            return;
+
+        case DEDUP_NEW_REORDERED:
+            pDevice->reordered++;
+            atomic_inc(&gReordered);
+            break;
+
+        case DEDUP_NEW_REBOOT:
+            pDevice->reboots++;
+            atomic_inc(&gReboots);
+            printk("Broadcaster %d rebooted (boot epoch 0x%04x)\r\n", deviceIndex, sample.meas.boot_epoch);
+            break;
+
+        default:
+            break;
+    }
+
+    // Hand the measurement over to the uplink thread. This runs in the
+    // Bluetooth RX thread, so it should never block: if the queue is
+    // full the sample is dropped (and counted in the ingest stats)
+    sample.deviceIndex = (uint16_t)deviceIndex;
+    sample.rssi = pDevice->rssi;
+    sample.rxTimeMs = pDevice->lastSeenMs;
+#if defined(CONFIG_AQM_TIME_SYNC)
+    // stamped at reception, back to when the broadcaster measured it. Zero
+    // until the clock is synced: the uplink stamps it then
+    sample.timeMs = timeSyncSampleMs( &sample );
+#else
+    sample.timeMs = 0;
+#endif
+    ingestQueuePut( &sample );
+
+#if defined(CONFIG_AQM_TRACE)
+    // the first reception of this measurement
+    traceReceived( &sample );
+    traceAdd( TRACE_STAGE_CALLBACK, k_cyc_to_us_floor32( k_cycle_get_32() - gCallbackCycles ) );
+#endif
+
+#if defined(CONFIG_AQM_LAN_UDP)
+    // the local consumers get it right away, whatever the uplink does
+    lanUdpPut( &sample );
+#endif
+
+    pDevice->lastMsgId = sample.meas.message_id;
+    pDevice->sampleCount++;
+
+#if defined(CONFIG_AQM_SCAN_SCHEDULE)
+    // learn when this broadcaster advertises. If it was the last one
+    // expected in the current scan window, close the window now
+    if( ( result != DEDUP_NEW_REORDERED ) &&
+        scanScheduleObserve(deviceIndex, sample.rxTimeMs, sample.meas.message_id) &&
+        ( gScanMode == SCAN_MODE_WINDOW ) ){
+        k_work_reschedule(&gScanWork, K_NO_WAIT);
+    }
+#endif
+}
+
+
+static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+		    struct net_buf_simple *buf)
+{
+    advParseResult_t result = { 0 };
+    deviceEntry_t *pDevice;
+    int index;
+
+#if defined(CONFIG_AQM_TRACE)
+    gCallbackCycles = k_cycle_get_32();
+#endif
+
+    atomic_inc(&gAdvSeen);
+
+    // O(1) lookup of the advertiser in the device table
+    index = deviceTableFind(addr);
+
+    // parse the whole advertisement packet once. The name only matters
+    // for devices not known yet
+    result.checkName = ( index < 0 );
+    bt_data_parse(buf, adv_parse, &result);
+
+    // unknown device: if it has the AQM header or the broadcaster name,
+    // add it to the table
+    if( index < 0 ){
+        if( !result.tagFound && !result.nameFound )
+            return;
+
+        index = deviceTableAdd(addr);
+        if( index < 0 ){
+            atomic_inc(&gTableFull);
+            return;
+        }
+
+        char addrStr[BT_ADDR_LE_STR_LEN];
+        bt_addr_le_to_str(addr, addrStr, sizeof(addrStr));
+        printk("Found Broadcaster %s. Address: %s (device %d)\r\n",
+                result.tagFound ? "Tag" : "Name", addrStr, index);
+    }
+
+    atomic_inc(&gAdvMatched);
+
+    pDevice = deviceTableGet(index);
+    pDevice->rssi = rssi;
+    pDevice->lastSeenMs = k_uptime_get_32();
+    pDevice->advCount++;
+
+    // parse data to get measurement
+    if( result.pMfgData != NULL ){
+        adv_data_found(index, result.pMfgData, result.mfgDataLen);
+    }
+}
+
+
+/** Starts scanning in the requested mode */
+static int scanStartMode(scanMode_t mode)
+{
+    // BLE scanning parameters. Broadcasters that send the AQM header in the
+    // primary advertisement are found without scan requests (passive scan),
+    // older ones need an active scan to get their name (scan response)
+    struct bt_le_scan_param scan_param = {
+#if defined(CONFIG_AQM_SCAN_PASSIVE_DISCOVERY)
+            .type       = BT_HCI_LE_SCAN_PASSIVE,
+#else
+            .type       = BT_HCI_LE_SCAN_ACTIVE,
+#endif
+            .options    = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
+            .interval   = 0x0010,
+            .window     = 0x0010,
+    };
+    int err;
+
+    // When tracking, the broadcasters are already known by address, so
+    // their name (in the scan response) is not needed either: scan passively
+    // and, if the accept list is loaded, let the controller drop every
+    // device not in it
+    if( mode != SCAN_MODE_DISCOVERY ){
+        scan_param.type = BT_HCI_LE_SCAN_PASSIVE;
+        if( atomic_get(&gAcceptListLen) > 0 ){
+            scan_param.options |= BT_LE_SCAN_OPT_FILTER_ACCEPT_LIST;
+        }
+    }
+
+    err = bt_le_scan_start(&scan_param, scan_cb);
+    if( err == 0 ){
+        gScanOnStartMs = k_uptime_get_32();
+    }
+
+    return err;
+}
+
+
+/** Stops scanning (if scanning) and accounts the scan time */
+static void scanStop(void)
+{
+    uint32_t onMs;
+
+    if( ( gScanMode == SCAN_MODE_STOPPED ) || ( gScanMode == SCAN_MODE_IDLE ) ){
+        return;
+    }
+
+    bt_le_scan_stop();
+
+    onMs = k_uptime_get_32() - gScanOnStartMs;
+    atomic_add(&gScanOnMs, (atomic_val_t)onMs);
+    if( ( gScanMode != SCAN_MODE_DISCOVERY ) && ( atomic_get(&gAcceptListLen) > 0 ) ){
+        atomic_add(&gFilteredMs, (atomic_val_t)onMs);
+    }
+}
+
+
+#if defined(CONFIG_AQM_SCAN_ACCEPT_LIST)
+
+/** Loads the addresses of all known broadcasters in the controller filter
+ * accept list. Scanning should be stopped. Returns the number of addresses
+ * loaded, or negative if the accept list cannot be used */
+static int scanLoadAcceptList(void)
+{
+    int count = (int)deviceTableCount();
+    int err;
+
+    if( ( count == 0 ) || ( count > CONFIG_AQM_SCAN_ACCEPT_LIST_SIZE ) ){
+        return -ENOSPC;
+    }
+
+    err = bt_le_filter_accept_list_clear();
+    if( err ){
+        return err;
+    }
+
+    for( int i = 0; i < count; i++ ){
+        err = bt_le_filter_accept_list_add(&deviceTableGet(i)->addr);
+        if( err ){
+            // e.g. the controller list is smaller than configured
+            bt_le_filter_accept_list_clear();
+            return err;
+        }
+    }
+
+    return count;
+}
+
+#endif
+
+
+/** Enters a scanning mode and schedules the next wake up of the work */
+static void scanEnterMode(scanMode_t mode, uint32_t untilMs)
+{
+    uint32_t nowMs = k_uptime_get_32();
+
+    if( mode != SCAN_MODE_IDLE ){
+        int err = scanStartMode(mode);
+        if( err ){
+            printk("Scanning failed to start (err %d), retrying\r\n", err);
+            gScanMode = SCAN_MODE_STOPPED;
+            k_work_schedule(&gScanWork, K_MSEC(SCAN_RETRY_DELAY_MS));
+            return;
+        }
+    }
+
+    if( mode == SCAN_MODE_DISCOVERY ){
+        atomic_inc(&gDiscoveries);
+    }
+
+    gScanMode = mode;
+    k_work_schedule(&gScanWork, K_MSEC( ( (int32_t)(untilMs - nowMs) > 0 ) ? untilMs - nowMs : 0 ));
+}
+
+
+static void scanWorkHandler(struct k_work *work)
+{
+    scanMode_t prevMode = gScanMode;
+    uint32_t nowMs;
+
+    // The accept list can only be changed while not scanning
+    scanStop();
+    nowMs = k_uptime_get_32();
+
+#if defined(CONFIG_AQM_SCAN_SCHEDULE)
+    if( prevMode == SCAN_MODE_WINDOW ){
+        // closed early if the last expected burst arrived before the deadline
+        scanScheduleWindowClosed( (int32_t)(gWindowCloseMs - nowMs) > 0 );
+    }
+#endif
+
+    // After a discovery scan, switch to the accept list (if it can hold
+    // all the broadcasters) and track the known broadcasters until the
+    // next discovery
+    if( prevMode == SCAN_MODE_DISCOVERY ){
+#if defined(CONFIG_AQM_SCAN_ACCEPT_LIST)
+        int loaded = scanLoadAcceptList();
+        atomic_set(&gAcceptListLen, ( loaded > 0 ) ? loaded : 0);
+#endif
+        gNextDiscoveryMs = nowMs + CONFIG_AQM_SCAN_DISCOVERY_PERIOD_S * 1000U;
+    }
+
+    if( (int32_t)(nowMs - gNextDiscoveryMs) >= 0 ){
+#if defined(CONFIG_AQM_SCAN_SCHEDULE)
+        scanScheduleCancel();
+#endif
+        scanEnterMode(SCAN_MODE_DISCOVERY, nowMs + CONFIG_AQM_SCAN_DISCOVERY_DURATION_S * 1000U);
+        return;
+    }
+
+#if defined(CONFIG_AQM_SCAN_SCHEDULE)
+    // the planned window is due
+    if( prevMode == SCAN_MODE_IDLE ){
+        scanEnterMode(SCAN_MODE_WINDOW, gWindowCloseMs);
+        return;
+    }
+
+    uint32_t openMs;
+    int expected = scanSchedulePlan(nowMs, &openMs, &gWindowCloseMs);
+
+    if( expected > 0 ){
+        if( (int32_t)(openMs - nowMs) > 0 ){
+            // radio off until the window opens (or the next discovery)
+            if( (int32_t)(gNextDiscoveryMs - openMs) < 0 ){
+                openMs = gNextDiscoveryMs;
+            }
+            scanEnterMode(SCAN_MODE_IDLE, openMs);
+        }
+        else{
+            scanEnterMode(SCAN_MODE_WINDOW, gWindowCloseMs);
+        }
+        return;
+    }
+
+    if( expected == 0 ){
+        // no broadcaster around, nothing to scan for until the next discovery
+        scanEnterMode(SCAN_MODE_IDLE, gNextDiscoveryMs);
+        return;
+    }
+
+    // some broadcaster has no learned schedule yet: scan continuously for a
+    // while and plan again
+    scanEnterMode(SCAN_MODE_CONTINUOUS, MIN(nowMs + SCAN_REPLAN_MS, gNextDiscoveryMs));
+#else
+    scanEnterMode(SCAN_MODE_CONTINUOUS, gNextDiscoveryMs);
+#endif
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+int scannerStart(void)
+{
+    int err = scanStartMode(SCAN_MODE_DISCOVERY);
+
+    if( err ){
+        return err;
+    }
+
+    gScanStartMs = gScanOnStartMs;
+    gScanMode = SCAN_MODE_DISCOVERY;
+    atomic_inc(&gDiscoveries);
+
+    k_work_schedule(&gScanWork, K_SECONDS(CONFIG_AQM_SCAN_DISCOVERY_DURATION_S));
+
+    return 0;
+}
+
+
+void scannerStop(void)
+{
+    k_work_cancel_delayable(&gScanWork);
+    scanStop();
+    gScanMode = SCAN_MODE_STOPPED;
+}
+
+
+void scannerGetStats(scannerStats_t *pStats)
+{
+    pStats->advSeen = (uint32_t)atomic_get(&gAdvSeen);
+    pStats->advMatched = (uint32_t)atomic_get(&gAdvMatched);
+    pStats->tableFull = (uint32_t)atomic_get(&gTableFull);
+    pStats->duplicates = (uint32_t)atomic_get(&gDuplicates);
+    pStats->reordered = (uint32_t)atomic_get(&gReordered);
+    pStats->stale = (uint32_t)atomic_get(&gStale);
+    pStats->reboots = (uint32_t)atomic_get(&gReboots);
+    pStats->discoveries = (uint32_t)atomic_get(&gDiscoveries);
+    pStats->acceptListLen = (uint32_t)atomic_get(&gAcceptListLen);
+    pStats->filteredMs = (uint32_t)atomic_get(&gFilteredMs);
+    pStats->scanOnMs = (uint32_t)atomic_get(&gScanOnMs);
+    pStats->elapsedMs = k_uptime_get_32() - gScanStartMs;
+
+    // add the current scan, if the radio is scanning now
+    if( ( gScanMode != SCAN_MODE_STOPPED ) && ( gScanMode != SCAN_MODE_IDLE ) ){
+        pStats->scanOnMs += k_uptime_get_32() - gScanOnStartMs;
+    }
+}
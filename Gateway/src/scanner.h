@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCANNER_H__
+#define  SCANNER_H__
+
+/** @file
+ * @brief The scanner handles the Bluetooth LE scanning. It finds the sensor
+ * broadcasters by the AQM header of their advertisement (or by their name,
+ * for older broadcasters), keeps them in the device table and puts every
+ * new measurement they broadcast in the ingest queue.
+ *
+ * The scanner alternates between discovery scans (any device) and tracking
+ * the known broadcasters. When CONFIG_AQM_SCAN_ACCEPT_LIST is enabled, the
+ * controller only reports the broadcasters loaded in its filter accept list
+ * while tracking. When CONFIG_AQM_SCAN_SCHEDULE is enabled, the scanner only
+ * scans around the predicted advertising bursts of the broadcasters while
+ * tracking (see scan_schedule.h).
+ * Discovery scans are passive when CONFIG_AQM_SCAN_PASSIVE_DISCOVERY is
+ * enabled, tracking scans are always passive.
+ */
+
+#include <stdint.h>
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the scanner */
+typedef struct{
+    uint32_t advSeen;       /**< Advertisements received from any device */
+    uint32_t advMatched;    /**< Advertisements received from known broadcasters */
+    uint32_t tableFull;     /**< Broadcasters ignored because the device table was full */
+    uint32_t duplicates;    /**< Measurements dropped as already received */
+    uint32_t reordered;     /**< New measurements received out of order */
+    uint32_t stale;         /**< Measurements dropped as too old for the window */
+    uint32_t reboots;       /**< Broadcaster reboots detected */
+    uint32_t discoveries;   /**< Discovery scans started */
+    uint32_t acceptListLen; /**< Broadcasters in the accept list, 0 when not in use */
+    uint32_t filteredMs;    /**< Total time (msec) scanned with the accept list */
+    uint32_t scanOnMs;      /**< Total time (msec) scanned */
+    uint32_t elapsedMs;     /**< Time (msec) since scanning was started */
+}scannerStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts scanning for sensor broadcasters, beginning with a discovery
+ *  scan. Bluetooth should be enabled.
+ *
+ * @return  zero on success else negative error code.
+ */
+int scannerStart(void);
+
+/** Stops scanning.
+ */
+void scannerStop(void);
+
+/** Gets a snapshot of the scanner statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void scannerGetStats(scannerStats_t *pStats);
+
+
+#endif // SCANNER_H__
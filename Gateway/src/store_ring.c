@@ -0,0 +1,224 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in store_ring.h
+ */
+
+#include "store_ring.h"
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <string.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+#define STORE_RING_LEN      CONFIG_AQM_STORE_RING_LEN
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+static aqmSample_t gRing[STORE_RING_LEN];
+
+/** Index of the oldest sample and number of samples in the ring */
+static uint32_t gHead;
+static uint32_t gCount;
+
+#if defined(CONFIG_AQM_STORE_DECIMATE)
+/** Per broadcaster (indexed by the device table index): only every
+ * gStride-th new sample is stored (decimation, 0 meaning 1) */
+static uint16_t gStride[CONFIG_AQM_MAX_DEVICES];
+static uint16_t gStrideCounter[CONFIG_AQM_MAX_DEVICES];
+
+/** Samples of every broadcaster seen while decimating the ring */
+static uint16_t gSeen[CONFIG_AQM_MAX_DEVICES];
+#endif
+
+/** Highest stride of the broadcasters */
+static atomic_t gStrideMax = ATOMIC_INIT(1);
+
+static atomic_t gQueued = ATOMIC_INIT(0);
+static atomic_t gDrained = ATOMIC_INIT(0);
+static atomic_t gDropped = ATOMIC_INIT(0);
+static atomic_t gDepth = ATOMIC_INIT(0);
+static atomic_t gMaxDepth = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+#if defined(CONFIG_AQM_STORE_DECIMATE)
+
+/** Drops every second sample of every broadcaster in the (full) ring,
+ * keeping its oldest one, and doubles the stride of the new samples stored
+ * for the broadcasters which lost samples. A broadcaster keeps its own time
+ * resolution whatever the interleaving of the samples in the ring. */
+static void storeRingDecimate(void)
+{
+    uint32_t kept = 0;
+
+    memset(gSeen, 0, sizeof(gSeen));
+
+    for( uint32_t i = 0; i < gCount; i++ ){
+        const aqmSample_t *pSample = &gRing[(gHead + i) % STORE_RING_LEN];
+
+        if( ( gSeen[pSample->deviceIndex]++ % 2 ) == 0 ){
+            gRing[(gHead + kept) % STORE_RING_LEN] = *pSample;
+            kept++;
+        }
+    }
+
+    for( uint32_t i = 0; i < CONFIG_AQM_MAX_DEVICES; i++ ){
+        uint32_t stride = ( gStride[i] == 0 ) ? 1 : gStride[i];
+
+        if( ( gSeen[i] < 2 ) || ( stride >= 0x8000 ) ){
+            continue;
+        }
+
+        stride *= 2;
+        gStride[i] = (uint16_t)stride;
+        gStrideCounter[i] = 0;
+        if( stride > (uint32_t)atomic_get(&gStrideMax) ){
+            atomic_set(&gStrideMax, (atomic_val_t)stride);
+        }
+    }
+
+    // a single sample of every broadcaster: nothing to thin, the oldest goes
+    if( kept == gCount ){
+        gHead = ( gHead + 1 ) % STORE_RING_LEN;
+        kept--;
+    }
+
+    atomic_add(&gDropped, (atomic_val_t)(gCount - kept));
+    gCount = kept;
+}
+
+#endif
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+bool storeRingPut(const aqmSample_t *pSample)
+{
+#if defined(CONFIG_AQM_STORE_DECIMATE)
+    uint16_t index = pSample->deviceIndex;
+
+    // keep the same time resolution as the samples of the broadcaster already in the ring
+    if( ( gStride[index] > 1 ) && ( ( gStrideCounter[index]++ % gStride[index] ) != 0 ) ){
+        atomic_inc(&gDropped);
+        return false;
+    }
+
+    if( gCount == STORE_RING_LEN ){
+        storeRingDecimate();
+    }
+#else
+    // make room dropping the oldest sample
+    if( gCount == STORE_RING_LEN ){
+        gHead = ( gHead + 1 ) % STORE_RING_LEN;
+        gCount--;
+        atomic_inc(&gDropped);
+    }
+#endif
+
+    gRing[(gHead + gCount) % STORE_RING_LEN] = *pSample;
+    gCount++;
+
+    atomic_inc(&gQueued);
+    atomic_set(&gDepth, (atomic_val_t)gCount);
+    if( gCount > (uint32_t)atomic_get(&gMaxDepth) ){
+        atomic_set(&gMaxDepth, (atomic_val_t)gCount);
+    }
+
+    return true;
+}
+
+
+bool storeRingPutFront(const aqmSample_t *pSample)
+{
+    // older than all the samples in the ring
+    if( gCount == STORE_RING_LEN ){
+#if defined(CONFIG_AQM_STORE_DECIMATE)
+        storeRingDecimate();
+#else
+        atomic_inc(&gDropped);
+        return false;
+#endif
+    }
+
+    gHead = ( gHead + STORE_RING_LEN - 1 ) % STORE_RING_LEN;
+    gRing[gHead] = *pSample;
+    gCount++;
+
+    atomic_inc(&gQueued);
+    atomic_set(&gDepth, (atomic_val_t)gCount);
+    if( gCount > (uint32_t)atomic_get(&gMaxDepth) ){
+        atomic_set(&gMaxDepth, (atomic_val_t)gCount);
+    }
+
+    return true;
+}
+
+
+bool storeRingGet(aqmSample_t *pSample)
+{
+    if( gCount == 0 ){
+        return false;
+    }
+
+    *pSample = gRing[gHead];
+    gHead = ( gHead + 1 ) % STORE_RING_LEN;
+    gCount--;
+
+    // drained: the next outage starts at full time resolution
+    if( gCount == 0 ){
+#if defined(CONFIG_AQM_STORE_DECIMATE)
+        memset(gStride, 0, sizeof(gStride));
+        memset(gStrideCounter, 0, sizeof(gStrideCounter));
+#endif
+        atomic_set(&gStrideMax, 1);
+    }
+
+    atomic_inc(&gDrained);
+    atomic_set(&gDepth, (atomic_val_t)gCount);
+
+    return true;
+}
+
+
+bool storeRingIsEmpty(void)
+{
+    return gCount == 0;
+}
+
+
+void storeRingGetStats(storeRingStats_t *pStats)
+{
+    pStats->queued = (uint32_t)atomic_get(&gQueued);
+    pStats->drained = (uint32_t)atomic_get(&gDrained);
+    pStats->dropped = (uint32_t)atomic_get(&gDropped);
+    pStats->depth = (uint32_t)atomic_get(&gDepth);
+    pStats->maxDepth = (uint32_t)atomic_get(&gMaxDepth);
+    pStats->stride = (uint32_t)atomic_get(&gStrideMax);
+}
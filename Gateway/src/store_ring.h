@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STORE_RING_H__
+#define  STORE_RING_H__
+
+/** @file
+ * @brief The store ring keeps the samples received while the link to the
+ * broker is down (store-and-forward), to publish them after reconnecting.
+ * It is a fixed-size ring (CONFIG_AQM_STORE_RING_LEN samples) in RAM.
+ *
+ * When the ring is full, the drop policy decides which samples are lost:
+ * - CONFIG_AQM_STORE_DROP_OLDEST: the oldest sample makes room for the new
+ *   one, the ring keeps the most recent samples.
+ * - CONFIG_AQM_STORE_DECIMATE: every second sample of every broadcaster in
+ *   the ring is dropped and from then on only every second new sample of
+ *   these broadcasters is stored (and so on, doubling their stride every
+ *   time the ring fills up), the ring keeps the whole outage of every
+ *   broadcaster at a lower time resolution.
+ *
+ * Only used by the uplink thread, not thread safe (except the statistics).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the store ring */
+typedef struct{
+    uint32_t queued;        /**< Samples stored in the ring */
+    uint32_t drained;       /**< Samples taken out of the ring to be published */
+    uint32_t dropped;       /**< Samples lost because of the drop policy */
+    uint32_t depth;         /**< Samples currently in the ring */
+    uint32_t maxDepth;      /**< Highest depth observed since boot */
+    uint32_t stride;        /**< Highest decimation stride of the broadcasters (1: no decimation) */
+}storeRingStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Stores a sample, applying the drop policy when the ring is full.
+ *
+ * @param pSample  The sample to be copied in the ring.
+ * @return         true if the sample was stored, false if it was dropped.
+ */
+bool storeRingPut(const aqmSample_t *pSample);
+
+/** Puts a sample back in front of the ring, e.g. a sample taken out of it
+ *  whose publish failed. When the ring is full, it is dropped
+ *  (CONFIG_AQM_STORE_DROP_OLDEST) or the ring is decimated first
+ *  (CONFIG_AQM_STORE_DECIMATE).
+ *
+ * @param pSample  The sample to be copied in the ring.
+ * @return         true if the sample was stored, false if it was dropped.
+ */
+bool storeRingPutFront(const aqmSample_t *pSample);
+
+/** Takes the oldest sample out of the ring.
+ *
+ * @param pSample  Where the sample is copied.
+ * @return         true on success, false if the ring is empty.
+ */
+bool storeRingGet(aqmSample_t *pSample);
+
+/** Checks if the ring is empty.
+ *
+ * @return  true if empty.
+ */
+bool storeRingIsEmpty(void);
+
+/** Gets a snapshot of the ring statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void storeRingGetStats(storeRingStats_t *pStats);
+
+
+#endif // STORE_RING_H__
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in telemetry.h
+ */
+
+#include "telemetry.h"
+
+#if defined(CONFIG_AQM_TELEMETRY)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <debug/thread_analyzer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "ubxlib.h"
+#include "device_table.h"
+#include "ingest_queue.h"
+#include "link.h"
+#include "scanner.h"
+#include "store_ring.h"
+#include "uplink.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Maximum length of a snapshot */
+#define TELEMETRY_MAX_LEN       768
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gTelemetryStack, CONFIG_AQM_TELEMETRY_THREAD_STACK_SIZE);
+static struct k_thread gTelemetryThread;
+
+/** Upper bound of every bucket but the last one, in the order of
+ * telemetryHist_t */
+static const uint32_t gHistBound[TELEMETRY_HIST_COUNT][TELEMETRY_HIST_BUCKETS - 1] = {
+    { 5, 10, 20, 50, 100, 200, 500, 1000, 2000 },
+    { 0, 1, 2, 4, 8, 16, 32, 64, 128 }
+};
+
+/** Names of the histograms in the snapshot */
+static const char *const gHistName[TELEMETRY_HIST_COUNT] = {
+    "pubMs",
+    "queueDepth"
+};
+
+static atomic_t gHist[TELEMETRY_HIST_COUNT][TELEMETRY_HIST_BUCKETS];
+
+/** The snapshot being encoded, only used by the telemetry thread (and the
+ * thread analyzer callback it calls) */
+static char gMessage[TELEMETRY_MAX_LEN];
+static size_t gLen;
+static bool gFirstThread;
+
+static atomic_t gSent = ATOMIC_INIT(0);
+static atomic_t gFailed = ATOMIC_INIT(0);
+static atomic_t gLastLen = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Appends to the snapshot. Once it is too long, gLen stays past the end */
+static void telemetryAppend(const char *pFormat, ...)
+{
+    va_list args;
+    int len;
+
+    if( gLen >= sizeof(gMessage) ){
+        return;
+    }
+
+    va_start(args, pFormat);
+    len = vsnprintf(&gMessage[gLen], sizeof(gMessage) - gLen, pFormat, args);
+    va_end(args);
+
+    gLen = ( len < 0 ) ? sizeof(gMessage) : gLen + (size_t)len;
+}
+
+
+/** Appends the stack headroom of a thread, called by the thread analyzer */
+static void telemetryThreadCb(struct thread_analyzer_info *pInfo)
+{
+    telemetryAppend("%s\"%s\":%u", gFirstThread ? "" : ",", pInfo->name,
+                    (uint32_t)( pInfo->stack_size - pInfo->stack_used ));
+    gFirstThread = false;
+}
+
+
+/** Encodes the snapshot. Returns its length, or zero if it does not fit */
+static size_t telemetryEncode(void)
+{
+    scannerStats_t scanStats;
+    ingestQueueStats_t queueStats;
+    uplinkStats_t uplinkStats;
+    linkStats_t linkStats;
+    storeRingStats_t ringStats;
+
+    scannerGetStats(&scanStats);
+    ingestQueueGetStats(&queueStats);
+    uplinkGetStats(&uplinkStats);
+    linkGetStats(&linkStats);
+    storeRingGetStats(&ringStats);
+
+    gLen = 0;
+
+    // the counters since boot: the rates are the differences between
+    // snapshots
+    telemetryAppend("{\"uptime\":%u,\"devices\":%u", k_uptime_get_32() / 1000, deviceTableCount());
+    telemetryAppend(",\"adverts\":{\"seen\":%u,\"matched\":%u,\"duplicates\":%u}",
+                    scanStats.advSeen, scanStats.advMatched, scanStats.duplicates);
+    telemetryAppend(",\"queue\":{\"depth\":%u,\"max\":%u,\"dropped\":%u}",
+                    queueStats.depth, queueStats.maxDepth, queueStats.dropped);
+    telemetryAppend(",\"publish\":{\"ok\":%u,\"failed\":%u,\"samples\":%u,\"samplesFailed\":%u}",
+                    uplinkStats.published, uplinkStats.failed,
+                    uplinkStats.samplesPublished, uplinkStats.samplesFailed);
+    telemetryAppend(",\"link\":{\"up\":%d,\"outages\":%u,\"reconnects\":%u,\"wifiReconnects\":%u,\"outageS\":%u}",
+                    linkStats.up ? 1 : 0, linkStats.outages, linkStats.attempts,
+                    linkStats.wifiReconnects, linkStats.totalOutageMs / 1000);
+    telemetryAppend(",\"store\":{\"depth\":%u,\"dropped\":%u}",
+                    ringStats.depth, ringStats.dropped);
+
+    for( int i = 0; i < TELEMETRY_HIST_COUNT; i++ ){
+        telemetryAppend(",\"%s\":[", gHistName[i]);
+        for( int j = 0; j < TELEMETRY_HIST_BUCKETS; j++ ){
+            telemetryAppend("%s%u", ( j == 0 ) ? "" : ",", (uint32_t)atomic_get(&gHist[i][j]));
+        }
+        telemetryAppend("]");
+    }
+
+    // negative if the port cannot tell
+    telemetryAppend(",\"heapMinFree\":%d", uPortGetHeapMinFree());
+
+    telemetryAppend(",\"stackFree\":{");
+    gFirstThread = true;
+    thread_analyzer_run(telemetryThreadCb);
+    telemetryAppend("}}");
+
+    return ( gLen < sizeof(gMessage) ) ? gLen : 0;
+}
+
+
+static void telemetryThread(void *p1, void *p2, void *p3)
+{
+    for( ;; ){
+        size_t len;
+
+        k_sleep(K_SECONDS(CONFIG_AQM_TELEMETRY_PERIOD_S));
+
+        if( !linkIsUp() ){
+            atomic_inc(&gFailed);
+            continue;
+        }
+
+        len = telemetryEncode();
+        if( len == 0 ){
+            atomic_inc(&gFailed);
+            printk("Telemetry snapshot too long\r\n");
+            continue;
+        }
+        atomic_set(&gLastLen, (atomic_val_t)len);
+
+        if( linkPublishTopic(LINK_TOPIC_TELEMETRY, gMessage, len, false) == 0 ){
+            atomic_inc(&gSent);
+        }
+        else{
+            atomic_inc(&gFailed);
+        }
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void telemetryStart(void)
+{
+    // below the uplink: the snapshot can wait
+    k_thread_create(&gTelemetryThread, gTelemetryStack,
+                    K_THREAD_STACK_SIZEOF(gTelemetryStack),
+                    telemetryThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY + 1), 0, K_NO_WAIT);
+    k_thread_name_set(&gTelemetryThread, "telemetry");
+}
+
+
+void telemetryHistAdd(telemetryHist_t hist, uint32_t value)
+{
+    int bucket = 0;
+
+    while( ( bucket < TELEMETRY_HIST_BUCKETS - 1 ) && ( value > gHistBound[hist][bucket] ) ){
+        bucket++;
+    }
+
+    atomic_inc(&gHist[hist][bucket]);
+}
+
+
+void telemetryGetStats(telemetryStats_t *pStats)
+{
+    pStats->sent = (uint32_t)atomic_get(&gSent);
+    pStats->failed = (uint32_t)atomic_get(&gFailed);
+    pStats->lastLen = (uint32_t)atomic_get(&gLastLen);
+}
+
+#endif // CONFIG_AQM_TELEMETRY
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TELEMETRY_H__
+#define  TELEMETRY_H__
+
+/** @file
+ * @brief The telemetry publishes a snapshot of the Gateway metrics on the
+ * telemetry topic every CONFIG_AQM_TELEMETRY_PERIOD_S (CONFIG_AQM_TELEMETRY),
+ * from a thread of its own, so the Gateway can be monitored remotely.
+ *
+ * The counters are the ones every module already keeps (atomics written by
+ * the thread owning them, see their GetStats() functions): the snapshot only
+ * reads them. On top of them the telemetry keeps fixed-bucket histograms,
+ * filled by the uplink thread with one atomic increment per value. The
+ * stack headroom of every thread comes from the thread analyzer.
+ */
+
+#include <stdint.h>
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Number of buckets of every histogram (the last one is unbounded) */
+#define TELEMETRY_HIST_BUCKETS  10
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** The histograms */
+typedef enum{
+    TELEMETRY_HIST_PUBLISH_MS,  /**< Duration (msec) of the measurement publishes */
+    TELEMETRY_HIST_QUEUE_DEPTH, /**< Ingest queue depth when the uplink takes a sample */
+    TELEMETRY_HIST_COUNT
+}telemetryHist_t;
+
+/** Statistics of the telemetry */
+typedef struct{
+    uint32_t sent;          /**< Snapshots published */
+    uint32_t failed;        /**< Snapshots not published (link down or publish failed) */
+    uint32_t lastLen;       /**< Length of the last snapshot */
+}telemetryStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the thread publishing the snapshots. The link (see link.h) should
+ *  be initialized.
+ */
+void telemetryStart(void);
+
+/** Adds a value to a histogram. Can be called from any thread.
+ *
+ * @param hist   The histogram.
+ * @param value  The value.
+ */
+void telemetryHistAdd(telemetryHist_t hist, uint32_t value);
+
+/** Gets a snapshot of the telemetry statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void telemetryGetStats(telemetryStats_t *pStats);
+
+
+#endif // TELEMETRY_H__
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in time_sync.h
+ */
+
+#include "time_sync.h"
+
+#if defined(CONFIG_AQM_TIME_SYNC)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <sys/byteorder.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ubxlib.h"
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** SNTP (RFC 4330) server port and message length */
+#define SNTP_PORT               123
+#define SNTP_MSG_LEN            48
+
+/** First byte of the request: no leap warning, version 4, mode 3 (client) */
+#define SNTP_REQUEST_FLAGS      0x23
+
+/** Mode of the answers of a server */
+#define SNTP_MODE_SERVER        4
+
+/** Offset of the transmit timestamp of the server in the answer */
+#define SNTP_TRANSMIT_OFFSET    40
+
+/** Seconds from 1900 (NTP era 0) to 1970 (Unix epoch) */
+#define SNTP_UNIX_OFFSET_S      2208988800ULL
+
+/** Delay (sec) before the next query after a failed one */
+#define TIME_SYNC_RETRY_S       10
+
+/** How often (msec) the link is checked before the first query */
+#define TIME_SYNC_WAIT_LINK_MS  1000
+
+/** How long (msec) the answer of the server is waited for */
+#define TIME_SYNC_ANSWER_MS     5000
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gTimeSyncStack, CONFIG_AQM_TIME_SYNC_THREAD_STACK_SIZE);
+static struct k_thread gTimeSyncThread;
+
+/** Epoch time (msec) minus uptime (msec), zero until the first sync. Too
+ * wide for an atomic_t: written by the time sync thread under the lock */
+static int64_t gOffsetMs;
+static struct k_spinlock gLock;
+
+/** The socket of a query, negative while not open. Only used under the
+ * link lock */
+static int32_t gSock = -1;
+
+/** Given by ubxlib when the answer arrives, with its uptime (msec) */
+static K_SEM_DEFINE(gAnswerSem, 0, 1);
+static int64_t gAnswerMs;
+
+static atomic_t gSyncs = ATOMIC_INIT(0);
+static atomic_t gFailures = ATOMIC_INIT(0);
+static atomic_t gLastSyncMs = ATOMIC_INIT(0);
+static atomic_t gLastRttMs = ATOMIC_INIT(0);
+static atomic_t gLastStepMs = ATOMIC_INIT(0);
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Converts the transmit timestamp of an SNTP answer to epoch time (msec) */
+static uint64_t timeSyncNtpToEpochMs(const uint8_t *pTimestamp)
+{
+    uint64_t seconds = sys_get_be32(pTimestamp);
+    uint32_t fraction = sys_get_be32(&pTimestamp[4]);
+
+    // the seconds wrap in 2036 (NTP era 1), times before 1970 cannot come
+    // from a working server
+    if( seconds < SNTP_UNIX_OFFSET_S ){
+        seconds += 1ULL << 32;
+    }
+
+    return ( seconds - SNTP_UNIX_OFFSET_S ) * 1000 + ( ( (uint64_t)fraction * 1000 ) >> 32 );
+}
+
+
+/** Called by ubxlib when the answer arrives */
+static void timeSyncDataCb(void *pParameter)
+{
+    gAnswerMs = k_uptime_get();
+    k_sem_give(&gAnswerSem);
+}
+
+
+/** Closes the socket, also called by the link (locked) before it is lost */
+static void timeSyncClose(void)
+{
+    if( gSock >= 0 ){
+        uSockClose(gSock);
+        gSock = -1;
+    }
+}
+
+
+/** Sends the request to the SNTP server, under the link lock */
+static int timeSyncSend(int64_t *pSentMs)
+{
+    uint8_t message[SNTP_MSG_LEN] = { SNTP_REQUEST_FLAGS };
+    uSockAddress_t address = { .port = SNTP_PORT };
+    uDeviceHandle_t devHandle;
+    int err = 0;
+
+    devHandle = linkSocketLock();
+    if( devHandle == NULL ){
+        return -ENOTCONN;
+    }
+
+    // the name lookup is the longest call under the lock, once per sync
+    if( uSockGetHostByName(devHandle, CONFIG_AQM_TIME_SYNC_SERVER, &address.ipAddress) != 0 ){
+        err = -EHOSTUNREACH;
+    }
+
+    if( err == 0 ){
+        gSock = uSockCreate(devHandle, U_SOCK_TYPE_DGRAM, U_SOCK_PROTOCOL_UDP);
+        if( gSock < 0 ){
+            err = (int)gSock;
+        }
+    }
+
+    if( err == 0 ){
+        uSockBlockingSet(gSock, false);
+        uSockRegisterCallbackData(gSock, timeSyncDataCb, NULL);
+        k_sem_reset(&gAnswerSem);
+
+        *pSentMs = k_uptime_get();
+        if( uSockSendTo(gSock, &address, message, sizeof(message)) != sizeof(message) ){
+            timeSyncClose();
+            err = -EIO;
+        }
+    }
+
+    linkSocketUnlock();
+
+    return err;
+}
+
+
+/** Queries the SNTP server once. On success sets the epoch time (msec) of
+ * the middle of the round-trip and its uptime (msec) */
+static int timeSyncQuery(uint64_t *pEpochMs, int64_t *pUptimeMs)
+{
+    uint8_t message[SNTP_MSG_LEN];
+    int32_t len = -ENOTCONN;
+    bool answered;
+    int64_t sentMs;
+    int64_t rttMs;
+    int err;
+
+    err = timeSyncSend(&sentMs);
+    if( err ){
+        return err;
+    }
+
+    // the answer is waited for without the lock, so the publishes go on
+    answered = ( k_sem_take(&gAnswerSem, K_MSEC(TIME_SYNC_ANSWER_MS)) == 0 );
+    rttMs = gAnswerMs - sentMs;
+
+    // if Wi-Fi went down meanwhile the link closes the socket
+    if( linkSocketLock() != NULL ){
+        if( answered && ( gSock >= 0 ) ){
+            len = uSockReceiveFrom(gSock, NULL, message, sizeof(message));
+        }
+        timeSyncClose();
+        linkSocketUnlock();
+    }
+
+    if( !answered ){
+        return -ETIMEDOUT;
+    }
+    if( len != sizeof(message) ){
+        return ( len < 0 ) ? (int)len : -EBADMSG;
+    }
+
+    // an answer of a server, not a kiss-o'-death (stratum 0) and with a time
+    if( ( ( message[0] & 0x07 ) != SNTP_MODE_SERVER ) || ( message[1] == 0 ) ||
+        ( sys_get_be32(&message[SNTP_TRANSMIT_OFFSET]) == 0 ) ){
+        return -EBADMSG;
+    }
+
+    atomic_set(&gLastRttMs, (atomic_val_t)rttMs);
+    *pEpochMs = timeSyncNtpToEpochMs(&message[SNTP_TRANSMIT_OFFSET]);
+    *pUptimeMs = sentMs + rttMs / 2;
+
+    return 0;
+}
+
+
+static void timeSyncThread(void *p1, void *p2, void *p3)
+{
+    for( ;; ){
+        uint64_t epochMs;
+        int64_t uptimeMs;
+        int64_t offsetMs;
+        k_spinlock_key_t key;
+        int err;
+
+        if( !linkIsUp() ){
+            k_sleep(K_MSEC(TIME_SYNC_WAIT_LINK_MS));
+            continue;
+        }
+
+        err = timeSyncQuery(&epochMs, &uptimeMs);
+        if( err ){
+            atomic_inc(&gFailures);
+            printk("Time sync failed (err %d)\r\n", err);
+            k_sleep(K_SECONDS(TIME_SYNC_RETRY_S));
+            continue;
+        }
+
+        offsetMs = (int64_t)epochMs - uptimeMs;
+
+        key = k_spin_lock(&gLock);
+        if( gOffsetMs != 0 ){
+            atomic_set(&gLastStepMs, (atomic_val_t)( offsetMs - gOffsetMs ));
+        }
+        gOffsetMs = offsetMs;
+        k_spin_unlock(&gLock, key);
+
+        atomic_set(&gLastSyncMs, (atomic_val_t)k_uptime_get_32());
+        if( atomic_inc(&gSyncs) == 0 ){
+            printk("Time synced, epoch %u s\r\n", (uint32_t)( epochMs / 1000 ));
+        }
+
+        k_sleep(K_SECONDS(CONFIG_AQM_TIME_SYNC_PERIOD_S));
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void timeSyncStart(void)
+{
+    linkAddSocketCloseCallback(timeSyncClose);
+
+    // below the uplink: only needed now and then
+    k_thread_create(&gTimeSyncThread, gTimeSyncStack,
+                    K_THREAD_STACK_SIZEOF(gTimeSyncStack),
+                    timeSyncThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY + 1), 0, K_NO_WAIT);
+    k_thread_name_set(&gTimeSyncThread, "time_sync");
+}
+
+
+bool timeSyncIsSynced(void)
+{
+    return atomic_get(&gSyncs) > 0;
+}
+
+
+uint64_t timeSyncEpochMs(uint32_t uptimeMs)
+{
+    int64_t nowMs = k_uptime_get();
+    int64_t offsetMs;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&gLock);
+    offsetMs = gOffsetMs;
+    k_spin_unlock(&gLock, key);
+
+    if( offsetMs == 0 ){
+        return 0;
+    }
+
+    // back from now, so the 32 bit uptime may have wrapped
+    return (uint64_t)( offsetMs + nowMs - (uint32_t)( (uint32_t)nowMs - uptimeMs ) );
+}
+
+
+uint64_t timeSyncSampleMs(const aqmSample_t *pSample)
+{
+    uint64_t epochMs = timeSyncEpochMs(pSample->rxTimeMs);
+
+    if( ( epochMs != 0 ) && ( pSample->meas.age_ms != AQM_TIME_UNKNOWN ) ){
+        epochMs -= pSample->meas.age_ms;
+    }
+
+    return epochMs;
+}
+
+
+void timeSyncGetStats(timeSyncStats_t *pStats)
+{
+    pStats->syncs = (uint32_t)atomic_get(&gSyncs);
+    pStats->failures = (uint32_t)atomic_get(&gFailures);
+    pStats->lastSyncMs = (uint32_t)atomic_get(&gLastSyncMs);
+    pStats->lastRttMs = (uint32_t)atomic_get(&gLastRttMs);
+    pStats->lastStepMs = (int32_t)atomic_get(&gLastStepMs);
+}
+
+#endif // CONFIG_AQM_TIME_SYNC
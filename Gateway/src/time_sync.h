@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIME_SYNC_H__
+#define  TIME_SYNC_H__
+
+/** @file
+ * @brief The time sync keeps the Gateway clock (Unix epoch, msec) in sync
+ * with an SNTP server (CONFIG_AQM_TIME_SYNC_SERVER), queried over a UDP
+ * socket of NINA-W156 every CONFIG_AQM_TIME_SYNC_PERIOD_S, from a thread of
+ * its own (CONFIG_AQM_TIME_SYNC).
+ *
+ * The clock is kept as the offset between the epoch and the uptime, so any
+ * uptime of the current boot (e.g. the reception time of a sample) can be
+ * converted, also the ones from before the first sync. The server time is
+ * taken as the middle of the request round-trip.
+ *
+ * The conversions can be called from any thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the time sync */
+typedef struct{
+    uint32_t syncs;         /**< Successful SNTP queries */
+    uint32_t failures;      /**< Failed SNTP queries (no answer, bad answer) */
+    uint32_t lastSyncMs;    /**< Uptime (msec) of the last sync, zero if never */
+    uint32_t lastRttMs;     /**< Round-trip time (msec) of the last query */
+    int32_t lastStepMs;     /**< Clock change (msec) at the last sync (drift) */
+}timeSyncStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the thread keeping the clock in sync. The link (see link.h)
+ *  should be initialized.
+ */
+void timeSyncStart(void);
+
+/** Checks if the clock was synced at least once.
+ *
+ * @return  true if synced.
+ */
+bool timeSyncIsSynced(void);
+
+/** Converts an uptime of the current boot to epoch time.
+ *
+ * @param uptimeMs  The uptime (msec), at most about 24 days ago.
+ * @return          the epoch time (msec), zero if the clock is not synced.
+ */
+uint64_t timeSyncEpochMs(uint32_t uptimeMs);
+
+/** Gets the epoch time of a measurement: its reception time, minus its age
+ *  on the broadcaster (if sent).
+ *
+ * @param pSample  The sample (received in the current boot).
+ * @return         the epoch time (msec), zero if the clock is not synced.
+ */
+uint64_t timeSyncSampleMs(const aqmSample_t *pSample);
+
+/** Gets a snapshot of the time sync statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void timeSyncGetStats(timeSyncStats_t *pStats);
+
+
+#endif // TIME_SYNC_H__
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in trace.h
+ */
+
+#include "trace.h"
+
+#if defined(CONFIG_AQM_TRACE)
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** A sample in the batch being built */
+typedef struct{
+    uint32_t rxTimeMs;      /**< Uptime (msec) of the reception */
+    uint32_t batchedMs;     /**< Uptime (msec) of the serialization */
+    uint16_t ageMs;         /**< Age at the reception, AQM_TIME_UNKNOWN if not sent */
+}traceBatchEntry_t;
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** Upper bound of every bucket but the last one */
+static const uint32_t gBucketBound[TRACE_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+/** Names of the stages, in the order of traceStage_t */
+static const char *const gStageName[TRACE_STAGE_COUNT] = {
+    "fetch",
+    "air",
+    "callback",
+    "queue",
+    "serialize",
+    "publish",
+    "total"
+};
+
+/** The histograms. The counters are atomics, the total is only written by
+ * the single writer of its stage (too wide for an atomic_t) */
+static atomic_t gCount[TRACE_STAGE_COUNT];
+static atomic_t gMax[TRACE_STAGE_COUNT];
+static atomic_t gBuckets[TRACE_STAGE_COUNT][TRACE_BUCKETS];
+static uint64_t gTotal[TRACE_STAGE_COUNT];
+
+/** The samples of the batch being built, only used by the uplink thread */
+static traceBatchEntry_t gBatch[CONFIG_AQM_BATCH_MAX_SAMPLES];
+static int gBatchCount;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void traceAdd(traceStage_t stage, uint32_t value)
+{
+    int bucket = 0;
+
+    while( ( bucket < TRACE_BUCKETS - 1 ) && ( value > gBucketBound[bucket] ) ){
+        bucket++;
+    }
+
+    atomic_inc(&gBuckets[stage][bucket]);
+    gTotal[stage] += value;
+    // single writer per stage, so a plain compare is enough here
+    if( value > (uint32_t)atomic_get(&gMax[stage]) ){
+        atomic_set(&gMax[stage], (atomic_val_t)value);
+    }
+    atomic_inc(&gCount[stage]);
+}
+
+
+void traceReceived(const aqmSample_t *pSample)
+{
+    // older broadcasters do not send their timing
+    if( pSample->meas.fetch_ms != AQM_TIME_UNKNOWN ){
+        traceAdd(TRACE_STAGE_FETCH, pSample->meas.fetch_ms);
+    }
+    if( pSample->meas.age_ms != AQM_TIME_UNKNOWN ){
+        traceAdd(TRACE_STAGE_AIR, pSample->meas.age_ms);
+    }
+}
+
+
+void traceBatched(const aqmSample_t *pSample, uint32_t nowMs)
+{
+    traceAdd(TRACE_STAGE_SERIALIZE, nowMs - pSample->rxTimeMs);
+
+    if( gBatchCount < CONFIG_AQM_BATCH_MAX_SAMPLES ){
+        gBatch[gBatchCount].rxTimeMs = pSample->rxTimeMs;
+        gBatch[gBatchCount].batchedMs = nowMs;
+        gBatch[gBatchCount].ageMs = pSample->meas.age_ms;
+        gBatchCount++;
+    }
+}
+
+
+void traceBatchPublished(bool ok, uint32_t nowMs)
+{
+    for( int i = 0; ok && ( i < gBatchCount ); i++ ){
+        const traceBatchEntry_t *pEntry = &gBatch[i];
+
+        traceAdd(TRACE_STAGE_PUBLISH, nowMs - pEntry->batchedMs);
+        if( pEntry->ageMs != AQM_TIME_UNKNOWN ){
+            traceAdd(TRACE_STAGE_TOTAL, pEntry->ageMs + ( nowMs - pEntry->rxTimeMs ));
+        }
+    }
+
+    gBatchCount = 0;
+}
+
+
+void traceGetStage(traceStage_t stage, traceStageStats_t *pStats)
+{
+    pStats->count = (uint32_t)atomic_get(&gCount[stage]);
+    pStats->total = gTotal[stage];
+    pStats->max = (uint32_t)atomic_get(&gMax[stage]);
+    for( int i = 0; i < TRACE_BUCKETS; i++ ){
+        pStats->buckets[i] = (uint32_t)atomic_get(&gBuckets[stage][i]);
+    }
+}
+
+
+uint32_t traceBucketBound(int bucket)
+{
+    return ( bucket < TRACE_BUCKETS - 1 ) ? gBucketBound[bucket] : UINT32_MAX;
+}
+
+
+uint32_t tracePercentile(const traceStageStats_t *pStats, uint32_t permille)
+{
+    uint32_t total = 0;
+    uint32_t seen = 0;
+
+    for( int i = 0; i < TRACE_BUCKETS; i++ ){
+        total += pStats->buckets[i];
+    }
+    if( total == 0 ){
+        return 0;
+    }
+
+    for( int i = 0; i < TRACE_BUCKETS - 1; i++ ){
+        seen += pStats->buckets[i];
+        // the first bucket reaching the requested share of the values
+        if( (uint64_t)seen * 1000 >= (uint64_t)total * permille ){
+            return MIN(gBucketBound[i], pStats->max);
+        }
+    }
+
+    return pStats->max;
+}
+
+
+const char *traceStageName(traceStage_t stage)
+{
+    return gStageName[stage];
+}
+
+#endif // CONFIG_AQM_TRACE
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACE_H__
+#define  TRACE_H__
+
+/** @file
+ * @brief The trace keeps a latency histogram for every stage a measurement
+ * goes through, from the sensor fetch on the broadcaster to the return of
+ * the publish on the Gateway (CONFIG_AQM_TRACE).
+ *
+ * The broadcaster sends the duration of the fetch and the age of the
+ * measurement along with it (see aqm_sample.h), the Gateway timestamps the
+ * rest: the reception in the scan callback, the enqueue, the take by the
+ * uplink thread, the serialization in the batch and the publish return.
+ *
+ * Every stage has a single writer (the Bluetooth RX thread for the first
+ * stages, the uplink thread for the others), the histograms can be read by
+ * any thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aqm_sample.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Number of buckets of every histogram (the last one is unbounded) */
+#define TRACE_BUCKETS       14
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** The traced stages. All in msec but TRACE_STAGE_CALLBACK (usec) */
+typedef enum{
+    TRACE_STAGE_FETCH,      /**< Sensor fetch on the broadcaster (single shot conversion) */
+    TRACE_STAGE_AIR,        /**< Fetch complete to first reception (advertising) */
+    TRACE_STAGE_CALLBACK,   /**< Scan callback entry to enqueue (usec) */
+    TRACE_STAGE_QUEUE,      /**< Reception to take by the uplink thread */
+    TRACE_STAGE_SERIALIZE,  /**< Reception to serialized in the batch */
+    TRACE_STAGE_PUBLISH,    /**< Serialized to publish return */
+    TRACE_STAGE_TOTAL,      /**< Fetch complete to publish return */
+    TRACE_STAGE_COUNT
+}traceStage_t;
+
+/** Histogram of a stage */
+typedef struct{
+    uint32_t count;                 /**< Values added */
+    uint64_t total;                 /**< Sum of the values */
+    uint32_t max;                   /**< Largest value */
+    uint32_t buckets[TRACE_BUCKETS];/**< Values per bucket, see traceBucketBound() */
+}traceStageStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Adds a value to the histogram of a stage.
+ *
+ * @param stage  The stage.
+ * @param value  The latency, in the unit of the stage.
+ */
+void traceAdd(traceStage_t stage, uint32_t value);
+
+/** Records the stages of a new sample up to the reception: the fetch and
+ *  advertising time reported by the broadcaster (if any). Called from the
+ *  scan callback.
+ *
+ * @param pSample  The sample.
+ */
+void traceReceived(const aqmSample_t *pSample);
+
+/** Records a sample just serialized in the batch. Called by the uplink
+ *  thread, only for the samples received since boot (not for the ones
+ *  replayed from the flash log).
+ *
+ * @param pSample  The sample.
+ * @param nowMs    Current uptime (msec).
+ */
+void traceBatched(const aqmSample_t *pSample, uint32_t nowMs);
+
+/** Records the end of the publish of the batch, and forgets its samples.
+ *  Called by the uplink thread whenever the batch is reset.
+ *
+ * @param ok     true if the publish succeeded (only then the publish and
+ *               total latency of the samples are recorded).
+ * @param nowMs  Current uptime (msec).
+ */
+void traceBatchPublished(bool ok, uint32_t nowMs);
+
+/** Gets a snapshot of the histogram of a stage.
+ *
+ * @param stage   The stage.
+ * @param pStats  Where the histogram is copied.
+ */
+void traceGetStage(traceStage_t stage, traceStageStats_t *pStats);
+
+/** Gets the upper bound of a bucket.
+ *
+ * @param bucket  The bucket.
+ * @return        the largest value counted in the bucket, UINT32_MAX for
+ *                the last one.
+ */
+uint32_t traceBucketBound(int bucket);
+
+/** Estimates a percentile of a histogram, as the upper bound of the bucket
+ *  holding it (the maximum for the last bucket).
+ *
+ * @param pStats   The histogram.
+ * @param permille The percentile, in 1/1000 (e.g. 990 for the 99th).
+ * @return         the estimate, zero if the histogram is empty.
+ */
+uint32_t tracePercentile(const traceStageStats_t *pStats, uint32_t permille);
+
+/** Gets the name of a stage.
+ *
+ * @param stage  The stage.
+ * @return       the name.
+ */
+const char *traceStageName(traceStage_t stage);
+
+
+#endif // TRACE_H__
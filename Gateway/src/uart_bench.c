@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in uart_bench.h
+ */
+
+#include "uart_bench.h"
+
+#if defined(CONFIG_AQM_UART_BENCH)
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <string.h>
+
+#include "link.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** Length of the short message (about one sample) */
+#define BENCH_SHORT_LEN     128
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+/** The rates benchmarked (baud). The nRF5340 UARTE goes up to 1 Mbaud */
+static const int32_t gBenchRates[] = {
+    115200, 230400, 460800, 921600, 1000000
+};
+
+static const size_t gBenchLens[] = {
+    BENCH_SHORT_LEN, CONFIG_AQM_BATCH_MAX_BYTES
+};
+
+static char gBenchMessage[CONFIG_AQM_BATCH_MAX_BYTES];
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Publishes the messages of one length at the current rate */
+static void uartBenchPublish(int32_t baudRate, size_t len)
+{
+    uint32_t minUs = UINT32_MAX;
+    uint32_t maxUs = 0;
+    uint32_t totalUs = 0;
+    uint32_t failed = 0;
+    uint32_t ok;
+
+    for( int i = 0; i < CONFIG_AQM_UART_BENCH_COUNT; i++ ){
+        uint32_t start = k_cycle_get_32();
+        uint32_t us;
+
+        if( linkPublishTopic(LINK_TOPIC_BENCH, gBenchMessage, len, false) != 0 ){
+            failed++;
+            continue;
+        }
+
+        us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+        totalUs += us;
+        minUs = MIN(minUs, us);
+        maxUs = MAX(maxUs, us);
+    }
+
+    ok = CONFIG_AQM_UART_BENCH_COUNT - failed;
+    if( ok == 0 ){
+        printk("UART bench: %7d baud, %4u bytes: all publishes failed\r\n",
+               baudRate, (uint32_t)len);
+        return;
+    }
+
+    // publishes per second in tenths, back to back
+    printk("UART bench: %7d baud, %4u bytes: round trip %u us average (min %u, max %u), %u.%u publishes/s, failed %u\r\n",
+           baudRate,
+           (uint32_t)len,
+           totalUs / ok,
+           minUs,
+           maxUs,
+           (uint32_t)( 10000000ULL * ok / MAX(totalUs, 1U) ) / 10,
+           (uint32_t)( 10000000ULL * ok / MAX(totalUs, 1U) ) % 10,
+           failed);
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void uartBenchRun(void)
+{
+    memset(gBenchMessage, 'x', sizeof(gBenchMessage));
+
+    for( int i = 0; i < ARRAY_SIZE(gBenchRates); i++ ){
+        if( linkSetBaudRate(gBenchRates[i]) != 0 ){
+            printk("UART bench: %7d baud not available\r\n", gBenchRates[i]);
+            continue;
+        }
+        if( linkConnect() != 0 ){
+            printk("UART bench: %7d baud, could not connect\r\n", gBenchRates[i]);
+            continue;
+        }
+
+        for( int j = 0; j < ARRAY_SIZE(gBenchLens); j++ ){
+            uartBenchPublish(gBenchRates[i], gBenchLens[j]);
+        }
+    }
+
+    // as after the bring-up, the uplink thread reconnects if this fails
+    linkSetBaudRate(CONFIG_AQM_NINA_BAUD_RATE);
+    linkConnect();
+}
+
+#endif // CONFIG_AQM_UART_BENCH
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UART_BENCH_H__
+#define  UART_BENCH_H__
+
+/** @file
+ * @brief On-target benchmark of the UART to NINA-W156
+ * (CONFIG_AQM_UART_BENCH). For every UART rate, publishes
+ * CONFIG_AQM_UART_BENCH_COUNT messages back to back (QoS 0) on the bench
+ * topic, for a short message and one of CONFIG_AQM_BATCH_MAX_BYTES, and
+ * prints the publish round trip time and the publishes per second.
+ *
+ * Run once by the bring-up thread after the first connection, before the
+ * uplink takes over. The link ends at CONFIG_AQM_NINA_BAUD_RATE.
+ */
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Runs the benchmark at every rate and prints the results.
+ */
+void uartBenchRun(void);
+
+
+#endif // UART_BENCH_H__
@@ -0,0 +1,698 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file
+ * @brief Contains the implementation of the API described in uplink.h
+ */
+
+#include "uplink.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/atomic.h>
+#include <errno.h>
+#if defined(CONFIG_TIMING_FUNCTIONS)
+#include <timing/timing.h>
+#endif
+
+#include "aggregate.h"
+#include "alarm.h"
+#include "batch.h"
+#include "deadband.h"
+#include "device_table.h"
+#include "flash_log.h"
+#include "inflight.h"
+#include "ingest_queue.h"
+#include "last_value.h"
+#include "link.h"
+#include "ownership.h"
+#include "store_ring.h"
+#include "telemetry.h"
+#include "time_sync.h"
+#include "trace.h"
+
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+
+/** How often (msec) the connection to the broker is checked */
+#define UPLINK_CONNECTION_CHECK_MS  1000
+
+/** Maximum length of an alarm message (a single sample) */
+#define UPLINK_ALARM_MAX_LEN        192
+
+
+/* ----------------------------------------------------------------
+ * GLOBALS
+ * -------------------------------------------------------------- */
+
+K_THREAD_STACK_DEFINE(gUplinkStack, CONFIG_AQM_UPLINK_THREAD_STACK_SIZE);
+static struct k_thread gUplinkThread;
+
+static atomic_t gPublished = ATOMIC_INIT(0);
+static atomic_t gFailed = ATOMIC_INIT(0);
+static atomic_t gSamplesPublished = ATOMIC_INIT(0);
+static atomic_t gSamplesFailed = ATOMIC_INIT(0);
+static atomic_t gFlushCount = ATOMIC_INIT(0);
+static atomic_t gFlushBytes = ATOMIC_INIT(0);
+static atomic_t gFlushAge = ATOMIC_INIT(0);
+static atomic_t gFlushSleep = ATOMIC_INIT(0);
+static atomic_t gBytesPublished = ATOMIC_INIT(0);
+static atomic_t gEncoded = ATOMIC_INIT(0);
+
+/** Uptime (msec) of the first sample received and of the first publish,
+ * zero until then */
+static atomic_t gFirstSampleMs = ATOMIC_INIT(0);
+static atomic_t gFirstPublishMs = ATOMIC_INIT(0);
+
+/** Only written by the uplink thread (too wide for an atomic_t) */
+static uint64_t gEncodeNs;
+
+/** Time spent in the publish calls, only written by the uplink thread */
+static uint32_t gPublishMsTotal;
+static uint32_t gPublishMsMax;
+
+/** Sequence number (flash log) of the last replayed sample in the batch,
+ * zero if none */
+static uint32_t gBatchLogSeq;
+static uint32_t gBatchLogSamples;
+
+/** Copy of the samples in the batch which are not in the flash log, stored
+ * again if the publish fails (or, with QoS 1, the batch is dropped) */
+static aqmSample_t gBatchSamples[CONFIG_AQM_BATCH_MAX_SAMPLES];
+static uint32_t gBatchSampleCount;
+
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+/** Rollups waiting for the link: index of the oldest one and count */
+static aggregateRollup_t gRollups[CONFIG_AQM_AGGREGATE_STORE_LEN];
+static uint32_t gRollupHead;
+static uint32_t gRollupCount;
+#endif
+
+#if defined(CONFIG_AQM_FLASH_LOG) && defined(CONFIG_AQM_UPLINK_QOS1)
+/** Sequence number (flash log) of the last cursor written */
+static uint32_t gCommittedLogSeq;
+#endif
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+/** Stores again, in order, the samples of a batch which could not be
+ * published, ahead of the samples received after them. With the flash log
+ * they are appended to it: it is replayed before the ring, its unread
+ * samples are older (the replayed samples of the batch, read again) and
+ * the outage is only stored in it from now on. Without it (or if it fails)
+ * they go back in front of the RAM ring */
+static void uplinkStoreAgain(const aqmSample_t *pSamples, uint32_t count)
+{
+    uint32_t stored = 0;
+
+#if defined(CONFIG_AQM_FLASH_LOG)
+    while( ( stored < count ) &&
+           ( flashLogPut(&pSamples[stored], &deviceTableGet(pSamples[stored].deviceIndex)->addr) == 0 ) ){
+        stored++;
+    }
+#endif
+
+    for( uint32_t i = count; i > stored; i-- ){
+        if( !storeRingPutFront(&pSamples[i - 1]) ){
+            atomic_inc(&gSamplesFailed);
+        }
+    }
+}
+
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+
+/** Stores again the samples (not in the flash log) of a batch dropped by
+ * the in-flight window, to be published again (after the newer batches
+ * acknowledged meanwhile) */
+static void uplinkStoreDropped(void)
+{
+    static aqmSample_t samples[CONFIG_AQM_BATCH_MAX_SAMPLES];
+    uint32_t count = inflightTakeDropped(samples);
+
+    if( count > 0 ){
+        uplinkStoreAgain(samples, count);
+        printk("%u samples dropped, stored again\r\n", count);
+    }
+}
+
+#endif
+
+
+/** Publishes the current batch (if not empty) and empties it */
+static void uplinkFlush(atomic_t *pReason)
+{
+    uint32_t count = batchCount();
+    const char *pMessage;
+    uint32_t startMs;
+    uint32_t publishMs;
+    int32_t err;
+    size_t len;
+
+    if( count == 0 ){
+        return;
+    }
+
+    atomic_inc(pReason);
+    pMessage = batchFinish(&len);
+
+    // One publish (AT round-trip) for all the samples in the batch
+    startMs = k_uptime_get_32();
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+    // QoS 1: handed over to the in-flight window, only waiting while the
+    // window is full (its batches dropped meanwhile are taken back)
+    do{
+        uplinkStoreDropped();
+        err = inflightPut(pMessage, len, count, gBatchLogSeq,
+                          gBatchSamples, gBatchSampleCount,
+                          K_MSEC(UPLINK_CONNECTION_CHECK_MS));
+    }while( ( err == -EAGAIN ) && linkIsUp() );
+#else
+    err = linkPublish(pMessage, len);
+#endif
+    publishMs = k_uptime_get_32() - startMs;
+#if defined(CONFIG_AQM_TELEMETRY)
+    telemetryHistAdd(TELEMETRY_HIST_PUBLISH_MS, publishMs);
+#endif
+
+    gPublishMsTotal += publishMs;
+    if( publishMs > gPublishMsMax ){
+        gPublishMsMax = publishMs;
+    }
+
+    if( err == 0 ){
+        atomic_cas(&gFirstPublishMs, 0, (atomic_val_t)k_uptime_get_32());
+        atomic_inc(&gPublished);
+        atomic_add(&gSamplesPublished, (atomic_val_t)count);
+        atomic_add(&gBytesPublished, (atomic_val_t)len);
+        printk("%s %u samples (%u bytes)\r\n",
+               IS_ENABLED(CONFIG_AQM_UPLINK_QOS1) ? "Queued" : "Published",
+               count, (uint32_t)len);
+
+#if defined(CONFIG_AQM_FLASH_LOG) && !defined(CONFIG_AQM_UPLINK_QOS1)
+        // the replayed samples will not be sent again, even after a reboot
+        if( gBatchLogSeq != 0 ){
+            flashLogCommit(gBatchLogSeq);
+        }
+#endif
+    }
+    else{
+        atomic_inc(&gFailed);
+        printk("Publish failed\r\n");
+        // maybe the connection was lost
+        linkCheck();
+
+#if defined(CONFIG_AQM_FLASH_LOG)
+        // the replayed samples are still in the flash log, read them again
+        if( gBatchLogSeq != 0 ){
+            flashLogRewind();
+        }
+#endif
+
+        // the others are stored again, and published once the link is up
+        // again (the rollups are lost)
+        atomic_add(&gSamplesFailed, (atomic_val_t)(count - gBatchLogSamples - gBatchSampleCount));
+        uplinkStoreAgain(gBatchSamples, gBatchSampleCount);
+    }
+
+#if defined(CONFIG_AQM_TRACE)
+    // with QoS 1 the publish returns when the batch is in the in-flight
+    // window, the acknowledgment time is in the in-flight stats
+    traceBatchPublished(err == 0, k_uptime_get_32());
+#endif
+
+    gBatchLogSeq = 0;
+    gBatchLogSamples = 0;
+    gBatchSampleCount = 0;
+    batchReset();
+}
+
+
+#if defined(CONFIG_AQM_FLASH_LOG) && defined(CONFIG_AQM_UPLINK_QOS1)
+
+/** Moves the flash log cursor after the replayed samples acknowledged by
+ * the broker, reads the log again from it when a batch was dropped */
+static void uplinkCommitAcked(void)
+{
+    uint32_t seq = inflightDoneLogSeq();
+
+    if( inflightLogRewind() ){
+        // the replayed samples of the batch being built are read again too,
+        // its acknowledgement does not move the cursor
+        gBatchLogSeq = 0;
+        flashLogRewind();
+        printk("Replayed samples dropped, replaying from the flash log cursor\r\n");
+    }
+
+    if( seq != gCommittedLogSeq ){
+        flashLogCommit(seq);
+        gCommittedLogSeq = seq;
+    }
+}
+
+#endif
+
+
+/** Adds a sample to the batch, flushing the batch when it is full.
+ * logSeq is the sequence number of a sample replayed from the flash log,
+ * zero for the others */
+static void uplinkBatchSample(const aqmSample_t *pSample, const bt_addr_le_t *pAddr,
+                              uint32_t logSeq)
+{
+    int err;
+
+#if defined(CONFIG_TIMING_FUNCTIONS)
+    // measure the encoding cost of the sample
+    timing_t start = timing_counter_get();
+
+    err = batchAdd(pSample, pAddr);
+
+    timing_t end = timing_counter_get();
+    gEncodeNs += timing_cycles_to_ns(timing_cycles_get(&start, &end));
+    atomic_inc(&gEncoded);
+#else
+    err = batchAdd(pSample, pAddr);
+#endif
+
+    // no room left for this sample: send what is there and start a new batch
+    if( err == -ENOSPC ){
+        uplinkFlush(&gFlushBytes);
+        err = batchAdd(pSample, pAddr);
+    }
+
+    if( err ){
+        atomic_inc(&gSamplesFailed);
+        printk("Sample of device %d could not be batched (err %d)\r\n", pSample->deviceIndex, err);
+        return;
+    }
+
+    if( logSeq != 0 ){
+        gBatchLogSeq = logSeq;
+        gBatchLogSamples++;
+    }
+    else{
+        if( gBatchSampleCount < CONFIG_AQM_BATCH_MAX_SAMPLES ){
+            gBatchSamples[gBatchSampleCount++] = *pSample;
+        }
+#if defined(CONFIG_AQM_TRACE)
+        // the replayed samples were received before the reboot
+        traceBatched(pSample, k_uptime_get_32());
+#endif
+    }
+
+    if( batchIsFull() ){
+        uplinkFlush(&gFlushCount);
+    }
+}
+
+
+/** Stamps a sample of the current boot received before the clock was synced */
+static void uplinkStamp(aqmSample_t *pSample)
+{
+#if defined(CONFIG_AQM_TIME_SYNC)
+    if( pSample->timeMs == 0 ){
+        pSample->timeMs = timeSyncSampleMs(pSample);
+    }
+#endif
+}
+
+
+/** Keeps a sample until the link is up again: in the flash log if enabled
+ * (and working), else in the RAM ring */
+static void uplinkStore(const aqmSample_t *pSample)
+{
+#if defined(CONFIG_AQM_FLASH_LOG)
+    if( flashLogPut(pSample, &deviceTableGet(pSample->deviceIndex)->addr) == 0 ){
+        return;
+    }
+#endif
+    storeRingPut(pSample);
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    storeRingStats_t ringStats;
+
+    // upload before the ring has to drop samples
+    storeRingGetStats(&ringStats);
+    if( linkIsAsleep() && ( ringStats.depth >= CONFIG_AQM_STORE_RING_LEN / 2 ) ){
+        linkWakeNow();
+    }
+#endif
+}
+
+
+/** Checks if there are stored samples waiting to be published */
+static bool uplinkStoreIsEmpty(void)
+{
+#if defined(CONFIG_AQM_FLASH_LOG)
+    if( !flashLogIsEmpty() ){
+        return false;
+    }
+#endif
+    return storeRingIsEmpty();
+}
+
+
+/** Adds the oldest stored sample (if any) to the batch. The flash log is
+ * older than the RAM ring: it holds the samples from before a reboot */
+static void uplinkForwardStored(void)
+{
+    aqmSample_t sample;
+
+#if defined(CONFIG_AQM_FLASH_LOG)
+    bt_addr_le_t addr;
+    uint32_t seq;
+
+    if( flashLogGet(&sample, &addr, &seq) ){
+        uplinkBatchSample(&sample, &addr, seq);
+        return;
+    }
+#endif
+
+    if( storeRingGet(&sample) ){
+        uplinkStamp(&sample);
+        uplinkBatchSample(&sample, &deviceTableGet(sample.deviceIndex)->addr, 0);
+    }
+}
+
+
+#if defined(CONFIG_AQM_ALARM)
+
+/** Publishes an alarm sample on its own, on the alarm topic */
+static void uplinkPublishAlarm(const aqmSample_t *pSample)
+{
+    static char message[UPLINK_ALARM_MAX_LEN];
+    bool ok = false;
+    int len;
+
+    len = batchEncodeSingle(pSample, &deviceTableGet(pSample->deviceIndex)->addr,
+                            message, sizeof(message));
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    // an alarm does not wait for the next upload
+    if( linkIsAsleep() ){
+        linkWakeNow();
+        linkService();
+    }
+#endif
+
+    // not stored while the link is down, the sample still takes the
+    // normal path
+    if( ( len > 0 ) && linkIsUp() ){
+        ok = ( linkPublishTopic(LINK_TOPIC_ALARM, message, len,
+                                IS_ENABLED(CONFIG_AQM_ALARM_QOS1)) == 0 );
+        if( !ok ){
+            linkCheck();
+        }
+    }
+
+    alarmPublished(pSample, ok, k_uptime_get_32());
+}
+
+#endif
+
+
+/** Takes a new sample from the ingest queue */
+static void uplinkIngest(const aqmSample_t *pSample)
+{
+    atomic_cas(&gFirstSampleMs, 0, (atomic_val_t)pSample->rxTimeMs);
+
+#if defined(CONFIG_AQM_OWNERSHIP)
+    // another Gateway receiving the broadcaster better publishes it
+    if( !ownershipCheck(pSample) ){
+        return;
+    }
+#endif
+
+#if defined(CONFIG_AQM_ALARM)
+    // fast lane: the alarm samples do not wait for the batch or the window
+    if( alarmCheck(pSample) ){
+        uplinkPublishAlarm(pSample);
+    }
+#endif
+
+#if defined(CONFIG_AQM_LAST_VALUE)
+    // the latest measurement as received, whatever the path below keeps
+    lastValueUpdate(pSample);
+#endif
+
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+    // only the rollups are published, at the end of every window
+    aggregateAdd(pSample);
+    return;
+#endif
+
+#if defined(CONFIG_AQM_DEADBAND)
+    // report by exception: only the samples which changed enough
+    if( !deadbandCheck(pSample) ){
+        return;
+    }
+#endif
+
+    // While the link is down, or stored samples are still waiting, the new
+    // samples are stored too (behind the stored ones)
+    if( !linkIsUp() || !uplinkStoreIsEmpty() ){
+        uplinkStore(pSample);
+    }
+    else{
+        uplinkBatchSample(pSample, &deviceTableGet(pSample->deviceIndex)->addr, 0);
+    }
+}
+
+
+/** Adds the rollups of the windows which have ended to the batch. While the
+ * link is down they wait in the rollup queue, the oldest one is lost when
+ * it is full */
+static void uplinkForwardRollups(uint32_t nowMs)
+{
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+    aggregateRollup_t rollup;
+
+    while( aggregateNext(nowMs, &rollup) ){
+        if( gRollupCount == CONFIG_AQM_AGGREGATE_STORE_LEN ){
+            gRollupHead = ( gRollupHead + 1 ) % CONFIG_AQM_AGGREGATE_STORE_LEN;
+            gRollupCount--;
+            atomic_inc(&gSamplesFailed);
+        }
+        gRollups[(gRollupHead + gRollupCount) % CONFIG_AQM_AGGREGATE_STORE_LEN] = rollup;
+        gRollupCount++;
+    }
+
+#if defined(CONFIG_AQM_POWER_GATING)
+    // upload before the queue has to drop rollups
+    if( linkIsAsleep() && ( gRollupCount >= ( CONFIG_AQM_AGGREGATE_STORE_LEN + 1 ) / 2 ) ){
+        linkWakeNow();
+    }
+#endif
+
+    while( ( gRollupCount > 0 ) && linkIsUp() ){
+        const aggregateRollup_t *pRollup = &gRollups[gRollupHead];
+        const bt_addr_le_t *pAddr = &deviceTableGet(pRollup->deviceIndex)->addr;
+        int err;
+
+        err = batchAddRollup(pRollup, pAddr);
+        if( err == -ENOSPC ){
+            uplinkFlush(&gFlushBytes);
+            err = batchAddRollup(pRollup, pAddr);
+        }
+
+        if( err ){
+            atomic_inc(&gSamplesFailed);
+            printk("Rollup of device %d could not be batched (err %d)\r\n", pRollup->deviceIndex, err);
+        }
+
+        gRollupHead = ( gRollupHead + 1 ) % CONFIG_AQM_AGGREGATE_STORE_LEN;
+        gRollupCount--;
+
+        if( batchIsFull() ){
+            uplinkFlush(&gFlushCount);
+        }
+    }
+#endif
+}
+
+
+#if defined(CONFIG_AQM_POWER_GATING)
+
+/** Checks if nothing is waiting to be sent: the rollups, the last values
+ * due and, with QoS 1, the in-flight window */
+static bool uplinkIsDrained(void)
+{
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+    if( gRollupCount > 0 ){
+        return false;
+    }
+#endif
+
+#if defined(CONFIG_AQM_LAST_VALUE)
+    // the ones not due yet wait for a later upload
+    if( lastValueIsDue(k_uptime_get_32()) ){
+        return false;
+    }
+#endif
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+    inflightStats_t inflightStats;
+
+    inflightGetStats(&inflightStats);
+    if( inflightStats.depth > 0 ){
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+#endif
+
+
+static void uplinkThread(void *p1, void *p2, void *p3)
+{
+    uint32_t lastCheckMs = k_uptime_get_32();
+    aqmSample_t sample;
+
+    for( ;; ){
+        // reconnects the link when it is down and the backoff has elapsed
+        int32_t reconnectMs = linkService();
+        int32_t waitMs = UPLINK_CONNECTION_CHECK_MS;
+        uint32_t nowMs;
+
+        uplinkForwardRollups(k_uptime_get_32());
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+        uplinkStoreDropped();
+#endif
+#if defined(CONFIG_AQM_FLASH_LOG) && defined(CONFIG_AQM_UPLINK_QOS1)
+        uplinkCommitAcked();
+#endif
+
+        // Block until a sample arrives, the oldest sample in the batch gets
+        // too old, a window ends or it is time to reconnect. While samples
+        // are stored, do not block: drain them at full rate.
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+        waitMs = MIN(waitMs, aggregateTimeLeftMs(k_uptime_get_32()));
+#endif
+        if( reconnectMs > 0 ){
+            waitMs = MIN(waitMs, reconnectMs);
+        }
+        else if( !uplinkStoreIsEmpty() ){
+            waitMs = 0;
+        }
+        else{
+            int32_t batchMs = batchTimeLeftMs(k_uptime_get_32());
+
+            if( batchMs >= 0 ){
+                waitMs = MIN(waitMs, batchMs);
+            }
+        }
+
+        if( ingestQueueGet(&sample, K_MSEC(waitMs)) == 0 ){
+#if defined(CONFIG_AQM_TELEMETRY)
+            ingestQueueStats_t queueStats;
+
+            ingestQueueGetStats(&queueStats);
+            telemetryHistAdd(TELEMETRY_HIST_QUEUE_DEPTH, queueStats.depth);
+#endif
+#if defined(CONFIG_AQM_TRACE)
+            traceAdd(TRACE_STAGE_QUEUE, k_uptime_get_32() - sample.rxTimeMs);
+#endif
+            uplinkStamp(&sample);
+            uplinkIngest(&sample);
+        }
+
+        if( !linkIsUp() ){
+            continue;
+        }
+
+        uplinkForwardStored();
+
+        nowMs = k_uptime_get_32();
+#if defined(CONFIG_AQM_LAST_VALUE)
+        lastValueService(nowMs);
+#endif
+        if( batchTimeLeftMs(nowMs) == 0 ){
+            uplinkFlush(&gFlushAge);
+        }
+
+#if defined(CONFIG_AQM_POWER_GATING)
+        // everything stored is sent: NINA-W156 sleeps until the next upload
+        if( uplinkStoreIsEmpty() ){
+            uplinkFlush(&gFlushSleep);
+            if( uplinkIsDrained() && linkSleep() ){
+                printk("NINA-W15 powered down for %d s\r\n", CONFIG_AQM_POWER_GATING_PERIOD_S);
+                continue;
+            }
+        }
+#endif
+
+        // the broker may be gone without a disconnect callback
+        if( nowMs - lastCheckMs >= UPLINK_CONNECTION_CHECK_MS ){
+            lastCheckMs = nowMs;
+            linkCheck();
+        }
+    }
+}
+
+
+/* ----------------------------------------------------------------
+ * FUNCTION IMPLEMENTATION
+ * -------------------------------------------------------------- */
+
+void uplinkStart(void)
+{
+#if defined(CONFIG_TIMING_FUNCTIONS)
+    timing_init();
+    timing_start();
+#endif
+
+#if defined(CONFIG_AQM_UPLINK_AGGREGATE)
+    aggregateStart(k_uptime_get_32());
+#endif
+
+#if defined(CONFIG_AQM_UPLINK_QOS1)
+    inflightStart();
+#endif
+
+    k_thread_create(&gUplinkThread, gUplinkStack,
+                    K_THREAD_STACK_SIZEOF(gUplinkStack),
+                    uplinkThread, NULL, NULL, NULL,
+                    K_PRIO_PREEMPT(CONFIG_AQM_UPLINK_THREAD_PRIORITY), 0, K_NO_WAIT);
+    k_thread_name_set(&gUplinkThread, "uplink");
+}
+
+
+void uplinkGetStats(uplinkStats_t *pStats)
+{
+    pStats->published = (uint32_t)atomic_get(&gPublished);
+    pStats->failed = (uint32_t)atomic_get(&gFailed);
+    pStats->samplesPublished = (uint32_t)atomic_get(&gSamplesPublished);
+    pStats->samplesFailed = (uint32_t)atomic_get(&gSamplesFailed);
+    pStats->bytesPublished = (uint32_t)atomic_get(&gBytesPublished);
+    pStats->flushCount = (uint32_t)atomic_get(&gFlushCount);
+    pStats->flushBytes = (uint32_t)atomic_get(&gFlushBytes);
+    pStats->flushAge = (uint32_t)atomic_get(&gFlushAge);
+    pStats->flushSleep = (uint32_t)atomic_get(&gFlushSleep);
+    pStats->encoded = (uint32_t)atomic_get(&gEncoded);
+    pStats->encodeNs = gEncodeNs;
+    pStats->publishMsTotal = gPublishMsTotal;
+    pStats->publishMsMax = gPublishMsMax;
+    pStats->firstSampleMs = (uint32_t)atomic_get(&gFirstSampleMs);
+    pStats->firstPublishMs = (uint32_t)atomic_get(&gFirstPublishMs);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 u-blox Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPLINK_H__
+#define  UPLINK_H__
+
+/** @file
+ * @brief The uplink thread blocks on the ingest queue, packs the samples it
+ * gets in batches (see batch.h) and publishes every batch as one message to
+ * the MQTT broker (Thingstream) via the link (see link.h).
+ *
+ * While the link is down the samples are kept in the store ring and they are
+ * published, oldest first, as soon as the link is up again.
+ *
+ * With CONFIG_AQM_UPLINK_QOS1 the batches are handed over to the in-flight
+ * window (see inflight.h), which publishes them with QoS 1 from its own
+ * thread.
+ */
+
+#include <zephyr.h>
+#include <stdint.h>
+
+
+/* ----------------------------------------------------------------
+ * TYPES
+ * -------------------------------------------------------------- */
+
+/** Statistics of the uplink */
+typedef struct{
+    uint32_t published;         /**< Messages published successfully (QoS 1: handed over to the window) */
+    uint32_t failed;            /**< Messages whose publish failed */
+    uint32_t samplesPublished;  /**< Samples in the messages published */
+    uint32_t samplesFailed;     /**< Samples lost (not batched, or publish failed and not stored again) */
+    uint32_t bytesPublished;    /**< Total length of the messages published */
+    uint32_t flushCount;        /**< Batches sent because they were full */
+    uint32_t flushBytes;        /**< Batches sent because the next sample did not fit */
+    uint32_t flushAge;          /**< Batches sent because their oldest sample was too old */
+    uint32_t flushSleep;        /**< Batches sent before NINA-W156 was powered down */
+    uint32_t encoded;           /**< Samples whose encoding time was measured */
+    uint64_t encodeNs;          /**< Total time (nsec) spent encoding those samples */
+    uint32_t publishMsTotal;    /**< Total time (msec) spent in the publish calls (QoS 1: waiting for the window) */
+    uint32_t publishMsMax;      /**< Longest publish call (msec) */
+    uint32_t firstSampleMs;     /**< Uptime (msec) the first sample was received, zero if not yet */
+    uint32_t firstPublishMs;    /**< Uptime (msec) of the first publish (QoS 1: handed over), zero if not yet */
+}uplinkStats_t;
+
+
+/* ----------------------------------------------------------------
+ * FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Starts the uplink thread. The link (see link.h) should be initialized,
+ *  it does not need to be connected, nor the module brought up: the uplink thread reconnects it when
+ *  it is down and keeps the samples received meanwhile in the store ring
+ *  (see store_ring.h).
+ */
+void uplinkStart(void);
+
+/** Gets a snapshot of the uplink statistics.
+ *
+ * @param pStats  Where the statistics are copied.
+ */
+void uplinkGetStats(uplinkStats_t *pStats);
+
+
+#endif // UPLINK_H__
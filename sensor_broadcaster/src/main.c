@@ -32,6 +32,7 @@
 #include <drivers/sensor.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
+#include <bluetooth/crypto.h>
 
 #include "scd4x.h"
 
@@ -48,10 +49,30 @@
 /** The period between sensor measurements (msec)*/
 #define MEASUREMENT_PERIOD        5000
 
+/** How often (msec) the age of the measurement is updated in the
+ * advertising data while it is advertised */
+#define ADVERTISING_AGE_UPDATE    100
+
 // Device Name Configuration (How it advertises)
 // The actual name that will appear is "ZephyrAQM"
 #define DEVICE_NAME CONFIG_BT_DEVICE_NAME "AQM"
 
+/** Protocol mode. When 1, the broadcaster identifies itself in the primary
+ * advertisement (company ID and AQM tag in front of the measurement data)
+ * and does not send a scan response, so the Gateway can discover it with a
+ * passive scan. When 0, the broadcaster identifies itself by its name in
+ * the scan response (the Gateway has to use an active scan to find it).
+ */
+#define ADV_IDENTITY_IN_PRIMARY   1
+
+/** Bluetooth SIG company identifier put in front of the measurement data.
+ * 0xFFFF is reserved for testing/prototypes, replace it with your own */
+#define AQM_COMPANY_ID            0xFFFF
+
+/** Tag following the company identifier, identifying an AQM broadcaster */
+#define AQM_ADV_TAG_0             'A'
+#define AQM_ADV_TAG_1             'Q'
+
 // sanity check
 #if( ADVERTISING_MEAS_PERIOD >= MEASUREMENT_PERIOD)
 	#error "Advertising period should be smaller than measurement period"
@@ -74,31 +95,84 @@
 
 /** Structure holding the measurements of the SCD41 sensor along with
  * an ascending number which is used as a message id, to separate the
- * measurement messages
+ * measurement messages, and a boot epoch. The message id restarts from 1
+ * after every reboot, so the receiver uses the boot epoch (a random number
+ * chosen at every boot) to tell a rebooted broadcaster apart from a
+ * repeated message.
+ * The age of the measurement (time since it was fetched from the sensor) is
+ * updated while it is advertised, so the receiver knows how old it is when
+ * received, and the fetch time shows how long the sensor took to measure.
  */
-struct{
+struct __packed{
 	float temperature;      /**< Temperature measurement */                    
 	float humidity;         /**< Humidity measurement */                        
 	float co2;              /**< CO2 measurement */                              
 	uint32_t message_id;    /**< Ascending number to identify measurement */
+	uint16_t boot_epoch;    /**< Random number, changes at every boot */
+	uint16_t age_ms;        /**< Time (msec) since the fetch completed, 0xFFFF: 65535 or more */
+	uint16_t fetch_ms;      /**< Duration (msec) of the sensor fetch, 0xFFFF: 65535 or more */
 }gMeasurement = { 0 };
 
-/** This byte array holds the bytes of the gMeasurement struct and
- * is used to pass the contents of the struct to the advertising data
- * of the device. (The gMeasurement struct is basicaly used to make clear
- * the arrangement of bytes in the gMfgData)
+#if ADV_IDENTITY_IN_PRIMARY
+/** Company identifier (little endian) and AQM tag, in front of the measurement */
+#define ADV_HEADER_LEN 4
+static const uint8_t gAdvHeader[ ADV_HEADER_LEN ] = {
+	( AQM_COMPANY_ID & 0xFF ), ( AQM_COMPANY_ID >> 8 ), AQM_ADV_TAG_0, AQM_ADV_TAG_1
+};
+#else
+#define ADV_HEADER_LEN 0
+#endif
+
+/** This byte array holds the bytes of the gMeasurement struct (after the
+ * header, if any) and is used to pass the contents of the struct to the
+ * advertising data of the device. (The gMeasurement struct is basicaly used
+ * to make clear the arrangement of bytes in the gMfgData)
 */
-static uint8_t gMfgData[ sizeof( gMeasurement ) ] = { 0 };
+static uint8_t gMfgData[ ADV_HEADER_LEN + sizeof( gMeasurement ) ] = { 0 };
 
 /** Set up the advertising data of the device*/
 static struct bt_data ad[] = {
 	BT_DATA( BT_DATA_MANUFACTURER_DATA, gMfgData, sizeof( gMfgData ) ),
 };
 
+#if ADV_IDENTITY_IN_PRIMARY
+/** No scan response: the advertisement is not scannable, the radio does not
+ * have to listen for scan requests after every advertising packet */
+static const struct bt_data *sd = NULL;
+#define SD_LEN 0
+#else
 /** Set Scan Response data */
 static const struct bt_data sd[] = {
 	BT_DATA( BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN ),
 };
+#define SD_LEN ARRAY_SIZE( sd )
+#endif
+
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/** Time (msec) since a given uptime, saturated to 16 bits */
+static uint16_t msSince( uint32_t sinceMs )
+{
+	uint32_t elapsed = k_uptime_get_32() - sinceMs;
+
+	return ( elapsed > UINT16_MAX ) ? UINT16_MAX : ( uint16_t )elapsed;
+}
+
+
+/** Copies the measurement struct (after the header, if any) to gMfgData,
+ * with its current age */
+static void updateMfgData( uint32_t fetchDoneMs )
+{
+	gMeasurement.age_ms = msSince( fetchDoneMs );
+
+#if ADV_IDENTITY_IN_PRIMARY
+	memcpy( gMfgData, gAdvHeader, ADV_HEADER_LEN );
+#endif
+	memcpy( &gMfgData[ ADV_HEADER_LEN ], &gMeasurement, sizeof( gMeasurement ) );
+}
 
 
 /* ----------------------------------------------------------------
@@ -135,16 +209,33 @@ void main( void )
 	}
 	printf( "Bluetooth initialized\r\n\r\n" );
 
+	// Choose the boot epoch. Zero is avoided, so that a receiver can use it
+	// as "no epoch known yet"
+	do {
+		err = bt_rand( &gMeasurement.boot_epoch, sizeof( gMeasurement.boot_epoch ) );
+		if( err ) {
+			printf( "Could not get boot epoch (err %d)\n", err );
+			return;
+		}
+	} while( gMeasurement.boot_epoch == 0 );
+	printf( "Boot epoch: 0x%04x\r\n\r\n", gMeasurement.boot_epoch );
+
 
 	// Get sensor measurements at set intervals and broadcast the 
 	// data via Bluetooth advertisement data
 	while( true ) {
+		// Trace points (uptime, msec) of this measurement
+		uint32_t fetchStartMs, fetchDoneMs, advDataMs, advStartMs;
 
-		// Get measurements
+		// Get measurements. In single shot mode this waits for the
+		// conversion of the sensor (about 5 s)
+		fetchStartMs = k_uptime_get_32();
 		if( sensor_sample_fetch( scd ) ) {
 			printf( "Failed to fetch sample from SCD4X device" );
 			return;
 		}
+		fetchDoneMs = k_uptime_get_32();
+		gMeasurement.fetch_ms = msSince( fetchStartMs );
 
 		sensor_channel_get( scd, SENSOR_CHAN_AMBIENT_TEMP, &temp );
 		sensor_channel_get( scd, SENSOR_CHAN_HUMIDITY, &hum );
@@ -177,7 +268,8 @@ void main( void )
 		// (The gMeasurement struct is used to make clear the arrangement of bytes
 		// in the message and make it easy to decompose this message on the receiver side -
 		// since both sides use the same MCU -> NORA-B1 -> nRF5340)
-		memcpy( gMfgData, &gMeasurement, sizeof( gMeasurement ) );
+		updateMfgData( fetchDoneMs );
+		advDataMs = k_uptime_get_32();
 
 		// print hex contents of gMfgData, data that will be advetised
 		printf( "Advertising Hex 0x  " );
@@ -188,14 +280,30 @@ void main( void )
 
 		// Start advertising 
 		err = bt_le_adv_start( BT_LE_ADV_NCONN_IDENTITY, ad, ARRAY_SIZE( ad ),
-				      sd, ARRAY_SIZE( sd ) );
+				      sd, SD_LEN );
 		if( err ) {
 			printf("Advertising failed to start (err %d)\n", err);
 			return;
 		}
 
-		// advertise for ADVERTISING_MEAS_PERIOD
-		k_msleep( ADVERTISING_MEAS_PERIOD );
+		advStartMs = k_uptime_get_32();
+
+		printf( "Trace: fetch %u ms, advertising data after %u ms, advertising after %u ms\r\n",
+		       gMeasurement.fetch_ms,
+		       advDataMs - fetchDoneMs,
+		       advStartMs - fetchDoneMs );
+
+		// advertise for ADVERTISING_MEAS_PERIOD, keeping the age of the
+		// measurement up to date
+		for( int elapsed = 0; elapsed < ADVERTISING_MEAS_PERIOD; elapsed += ADVERTISING_AGE_UPDATE ) {
+			k_msleep( ADVERTISING_AGE_UPDATE );
+
+			updateMfgData( fetchDoneMs );
+			err = bt_le_adv_update_data( ad, ARRAY_SIZE( ad ), sd, SD_LEN );
+			if( err ) {
+				printf( "Advertising data update failed (err %d)\n", err );
+			}
+		}
 
 		// stop advertising
 		err = bt_le_adv_stop();